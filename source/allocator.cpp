@@ -0,0 +1,63 @@
+#include "allocator.hpp"
+
+#include <new>
+
+namespace Lux {
+
+    Allocator::~Allocator()
+    {
+        for (void* arena : m_arenas)
+            ::operator delete(arena);
+    }
+
+    void* Allocator::allocate(size_t size)
+    {
+        if (size > MAX_SMALL_SIZE) return ::operator new(size);
+
+        size_t blockSize = getBlockSize(size);
+        FreeBlock*& freeList = m_freeLists[blockSize / GRANULARITY - 1];
+        if (freeList) {
+            FreeBlock* block = freeList;
+            freeList = block->next;
+            return block;
+        }
+
+        return allocateFromArena(blockSize);
+    }
+
+    void Allocator::free(void* block, size_t size)
+    {
+        if (size > MAX_SMALL_SIZE) {
+            ::operator delete(block);
+            return;
+        }
+
+        FreeBlock*& freeList = m_freeLists[getBlockSize(size) / GRANULARITY - 1];
+        FreeBlock* freeBlock = static_cast<FreeBlock*>(block);
+        freeBlock->next = freeList;
+        freeList = freeBlock;
+    }
+
+    void* Allocator::allocateFromArena(size_t blockSize)
+    {
+        if (static_cast<size_t>(m_arenaEnd - m_arenaTop) < blockSize) {
+            // Remainder of the old arena is too small for this class, hand it out to smaller ones.
+            while (static_cast<size_t>(m_arenaEnd - m_arenaTop) >= GRANULARITY) {
+                size_t remainder = static_cast<size_t>(m_arenaEnd - m_arenaTop);
+                size_t size = remainder < MAX_SMALL_SIZE ? remainder & ~(GRANULARITY - 1) : MAX_SMALL_SIZE;
+                free(m_arenaTop, size);
+                m_arenaTop += size;
+            }
+
+            char* arena = static_cast<char*>(::operator new(ARENA_SIZE));
+            m_arenas.emplace_back(arena);
+            m_arenaTop = arena;
+            m_arenaEnd = arena + ARENA_SIZE;
+        }
+
+        void* block = m_arenaTop;
+        m_arenaTop += blockSize;
+        return block;
+    }
+
+} // namespace Lux
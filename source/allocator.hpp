@@ -0,0 +1,45 @@
+#pragma once
+#include "common.hpp"
+
+#include <vector>
+
+namespace Lux {
+
+    // Allocates memory for heap objects. Small blocks come from free lists, one per size class,
+    // which are refilled by bumping a pointer through big arenas, so most allocations and frees
+    // are a couple of pointer operations and never reach the global heap. Blocks bigger than
+    // the largest size class are forwarded to operator new.
+    class Allocator
+    {
+    public:
+        static constexpr size_t GRANULARITY = 16;
+        static constexpr size_t MAX_SMALL_SIZE = 256;
+        static constexpr size_t ARENA_SIZE = 64 * 1024;
+
+        Allocator() = default;
+        ~Allocator();
+
+        void* allocate(size_t size);
+        // Size has to be the same as the one passed to allocate().
+        void free(void* block, size_t size);
+
+        static size_t getBlockSize(size_t size) { return size <= MAX_SMALL_SIZE ? (size + GRANULARITY - 1) & ~(GRANULARITY - 1) : size; }
+
+        Allocator(const Allocator&) = delete;
+        Allocator& operator=(const Allocator&) = delete;
+    private:
+        struct FreeBlock {
+            FreeBlock* next;
+        };
+
+        static constexpr size_t SIZE_CLASS_COUNT = MAX_SMALL_SIZE / GRANULARITY;
+
+        void* allocateFromArena(size_t blockSize);
+
+        FreeBlock* m_freeLists[SIZE_CLASS_COUNT]{};
+        std::vector<void*> m_arenas;
+        char* m_arenaTop = nullptr;
+        char* m_arenaEnd = nullptr;
+    };
+
+} // namespace Lux
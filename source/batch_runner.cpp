@@ -0,0 +1,83 @@
+#include "batch_runner.hpp"
+
+#include <algorithm>
+
+namespace Lux {
+
+    BatchRunner::BatchRunner(size_t threadCount, Backend backend)
+    {
+        if (threadCount == 0)
+            threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+
+        m_workers.reserve(threadCount);
+        for (size_t i = 0; i < threadCount; i++)
+            m_workers.emplace_back(&BatchRunner::work, this, backend);
+    }
+
+    BatchRunner::~BatchRunner()
+    {
+        {
+            std::lock_guard lock{ m_mutex };
+            m_stopping = true;
+        }
+        m_jobAvailable.notify_all();
+
+        for (std::thread& worker : m_workers)
+            worker.join();
+    }
+
+    void BatchRunner::submit(std::shared_ptr<const Program> program)
+    {
+        {
+            std::lock_guard lock{ m_mutex };
+            Result* result = &m_results.emplace_back();
+            m_jobs.push_back({ std::move(program), result });
+            m_pendingJobs++;
+        }
+        m_jobAvailable.notify_one();
+    }
+
+    std::vector<BatchRunner::Result> BatchRunner::wait()
+    {
+        std::unique_lock lock{ m_mutex };
+        m_jobsDone.wait(lock, [this] { return m_pendingJobs == 0; });
+
+        std::vector<Result> results{ std::make_move_iterator(m_results.begin()), std::make_move_iterator(m_results.end()) };
+        m_results.clear();
+        return results;
+    }
+
+    void BatchRunner::work(Backend backend)
+    {
+        VM vm;
+        vm.setBackend(backend);
+
+        while (true) {
+            Job job;
+            {
+                std::unique_lock lock{ m_mutex };
+                m_jobAvailable.wait(lock, [this] { return m_stopping || !m_jobs.empty(); });
+                if (m_jobs.empty())
+                    return;
+
+                job = std::move(m_jobs.front());
+                m_jobs.pop_front();
+            }
+
+            // The result is only touched by this worker until the job is counted as done.
+            vm.setOutput(&job.result->output);
+            job.result->result = vm.run(*job.program);
+            vm.setOutput(nullptr);
+            job.program.reset();
+
+            bool done;
+            {
+                std::lock_guard lock{ m_mutex };
+                done = --m_pendingJobs == 0;
+            }
+            if (done)
+                m_jobsDone.notify_all();
+        }
+    }
+
+} // namespace Lux
@@ -0,0 +1,58 @@
+#pragma once
+#include "common.hpp"
+#include "program.hpp"
+#include "vm.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Lux {
+
+    // Runs programs on a pool of worker threads. Every worker owns a VM (stack, heap and globals),
+    // the workers share nothing but the programs, which never change after they're compiled.
+    class BatchRunner
+    {
+    public:
+        struct Result {
+            InterpretResult result = InterpretResult::Success;
+            std::string output; // print statements and runtime errors of the run
+        };
+
+        // threadCount of 0 uses one thread per hardware thread.
+        explicit BatchRunner(size_t threadCount = 0, Backend backend = Backend::Stack);
+        ~BatchRunner();
+
+        // Queues a run of program with fresh globals, it can start before wait is called.
+        void submit(std::shared_ptr<const Program> program);
+        // Blocks until every submitted run is finished, results are in submission order.
+        std::vector<Result> wait();
+
+        size_t getThreadCount() const { return m_workers.size(); }
+
+        BatchRunner(const BatchRunner&) = delete;
+        BatchRunner& operator=(const BatchRunner&) = delete;
+    private:
+        struct Job {
+            std::shared_ptr<const Program> program;
+            Result* result;
+        };
+
+        void work(Backend backend);
+
+        std::vector<std::thread> m_workers;
+        std::mutex m_mutex;
+        std::condition_variable m_jobAvailable;
+        std::condition_variable m_jobsDone;
+        std::deque<Job> m_jobs;
+        // Deque so results of queued jobs stay in place while more are submitted.
+        std::deque<Result> m_results;
+        size_t m_pendingJobs = 0;
+        bool m_stopping = false;
+    };
+
+} // namespace Lux
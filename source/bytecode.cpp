@@ -0,0 +1,268 @@
+#include "bytecode.hpp"
+#include "chunk.hpp"
+#include "heap.hpp"
+#include "types/string.hpp"
+
+#include <bit>
+#include <cstring>
+
+namespace Lux {
+
+    static constexpr uint8_t MAGIC[4] = { 'L', 'U', 'X', 'B' };
+
+    namespace {
+
+        class Writer
+        {
+        public:
+            explicit Writer(std::vector<uint8_t>& data) : m_data{ data } {}
+
+            void write(const void* bytes, size_t size)
+            {
+                const uint8_t* begin = static_cast<const uint8_t*>(bytes);
+                m_data.insert(m_data.end(), begin, begin + size);
+            }
+            template <typename T>
+            void write(T value)
+            {
+                for (size_t i = 0; i < sizeof(T); i++)
+                    m_data.emplace_back(static_cast<uint8_t>(static_cast<uint64_t>(value) >> (8 * i)));
+            }
+            void writeString(const String& string)
+            {
+                write(static_cast<uint32_t>(string.length()));
+                write(string.data(), string.length());
+            }
+        private:
+            std::vector<uint8_t>& m_data;
+        };
+
+        // Every read is bounds checked, after the first failure all reads fail.
+        class Reader
+        {
+        public:
+            Reader(const uint8_t* data, size_t size) : m_data{ data }, m_size{ size } {}
+
+            const uint8_t* read(size_t size)
+            {
+                if (!m_isValid || m_size - m_offset < size) {
+                    m_isValid = false;
+                    return nullptr;
+                }
+                const uint8_t* bytes = m_data + m_offset;
+                m_offset += size;
+                return bytes;
+            }
+            template <typename T>
+            T read()
+            {
+                const uint8_t* bytes = read(sizeof(T));
+                if (!bytes) return T{};
+
+                uint64_t value = 0;
+                for (size_t i = 0; i < sizeof(T); i++)
+                    value |= static_cast<uint64_t>(bytes[i]) << (8 * i);
+                return static_cast<T>(value);
+            }
+            String* readString(Heap& heap)
+            {
+                uint32_t length = read<uint32_t>();
+                const uint8_t* chars = read(length);
+                return chars ? heap.makeString(reinterpret_cast<const char*>(chars), length) : nullptr;
+            }
+
+            bool isValid() const { return m_isValid; }
+            bool isAtEnd() const { return m_offset == m_size; }
+        private:
+            const uint8_t* m_data;
+            size_t m_size;
+            size_t m_offset = 0;
+            bool m_isValid = true;
+        };
+
+    } // namespace
+
+    bool Bytecode::isBytecode(const uint8_t* data, size_t size)
+    {
+        return size >= sizeof(MAGIC) && std::memcmp(data, MAGIC, sizeof(MAGIC)) == 0;
+    }
+
+    std::vector<uint8_t> Bytecode::serialize(const Chunk& chunk)
+    {
+        std::vector<uint8_t> data;
+        data.reserve(HEADER_SIZE + chunk.getCodeSize());
+        Writer writer{ data };
+
+        writer.write(MAGIC, sizeof(MAGIC));
+        writer.write(VERSION);
+        writer.write(static_cast<uint8_t>(OpCode::Count));
+        writer.write(uint8_t{ 0 });
+        writer.write(static_cast<uint32_t>(chunk.getCodeSize()));
+        writer.write(static_cast<uint32_t>(chunk.m_lines.size()));
+        writer.write(static_cast<uint32_t>(chunk.m_constants.size()));
+        writer.write(static_cast<uint32_t>(chunk.m_globalNames.size()));
+        writer.write(static_cast<uint32_t>(chunk.m_loopCount));
+
+        writer.write(chunk.getCodeRawPtr(), chunk.getCodeSize());
+
+        for (const Chunk::LineInfo& run : chunk.m_lines) {
+            writer.write(static_cast<uint32_t>(run.line));
+            writer.write(static_cast<uint32_t>(run.indexOffset));
+        }
+
+        for (Value constant : chunk.m_constants) {
+            if (constant.isNil())
+                writer.write(ConstantType::Nil);
+            else if (constant.isBool()) {
+                writer.write(ConstantType::Bool);
+                writer.write(static_cast<uint8_t>(constant.asBool()));
+            }
+            else if (constant.isNumber()) {
+                writer.write(ConstantType::Number);
+                writer.write(std::bit_cast<uint64_t>(constant.asNumber()));
+            }
+            else {
+                writer.write(ConstantType::String);
+                writer.writeString(*constant.asObject()->asString());
+            }
+        }
+
+        for (const String* name : chunk.m_globalNames)
+            writer.writeString(*name);
+
+        return data;
+    }
+
+    bool Bytecode::deserialize(const uint8_t* data, size_t size, Chunk& chunk, Heap& heap)
+    {
+        if (size < HEADER_SIZE) return false;
+        Reader header{ data, HEADER_SIZE };
+        const uint8_t* magic = header.read(sizeof(MAGIC));
+        if (!magic || std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0) return false;
+        // Opcode numbering isn't part of the version, files written by a build with different opcodes are rejected too.
+        if (header.read<uint16_t>() != VERSION || header.read<uint8_t>() != static_cast<uint8_t>(OpCode::Count)) return false;
+        header.read<uint8_t>();
+
+        uint32_t codeSize = header.read<uint32_t>();
+        uint32_t lineCount = header.read<uint32_t>();
+        uint32_t constantCount = header.read<uint32_t>();
+        uint32_t globalCount = header.read<uint32_t>();
+        uint32_t loopCount = header.read<uint32_t>();
+        if (!header.isValid() || !header.isAtEnd()) return false;
+
+        Reader reader{ data + HEADER_SIZE, size - HEADER_SIZE };
+
+        chunk = {};
+        chunk.m_loopCount = loopCount;
+        const uint8_t* code = reader.read(codeSize);
+        if (!code) return false;
+        chunk.setExternalCode(code, codeSize);
+
+        for (uint32_t i = 0; i < lineCount && reader.isValid(); i++) {
+            size_t line = reader.read<uint32_t>();
+            size_t indexOffset = reader.read<uint32_t>();
+            chunk.m_lines.emplace_back(line, indexOffset);
+        }
+
+        // Constants are unique already, they keep their indices.
+        for (uint32_t i = 0; i < constantCount && reader.isValid(); i++) {
+            switch (reader.read<ConstantType>())
+            {
+            case ConstantType::Nil:
+                chunk.m_constants.emplace_back(Value::makeNil());
+                break;
+            case ConstantType::Bool:
+                chunk.m_constants.emplace_back(Value::makeBool(reader.read<uint8_t>() != 0));
+                break;
+            case ConstantType::Number:
+                chunk.m_constants.emplace_back(Value::makeNumber(std::bit_cast<double>(reader.read<uint64_t>())));
+                break;
+            case ConstantType::String:
+                if (String* string = reader.readString(heap))
+                    chunk.m_constants.emplace_back(Value::makeObject(string));
+                break;
+            default:
+                return false;
+            }
+        }
+
+        for (uint32_t i = 0; i < globalCount && reader.isValid(); i++)
+            if (String* name = reader.readString(heap))
+                chunk.m_globalNames.emplace_back(name);
+
+        return reader.isValid() && reader.isAtEnd() && isCodeValid(chunk) && chunk.computeMaxStackDepth();
+    }
+
+    bool Bytecode::isCodeValid(const Chunk& chunk)
+    {
+        // Everything the VM relies on without checking is checked here, so a corrupted file can't make it read
+        // out of bounds. Values are still only checked when the code runs.
+        size_t lineBytes = 0;
+        for (const Chunk::LineInfo& run : chunk.m_lines)
+            lineBytes += run.indexOffset;
+        if (lineBytes != chunk.getCodeSize()) return false;
+
+        std::vector<bool> isInstructionStart(chunk.getCodeSize());
+        size_t offset = 0;
+        OpCode opcode = OpCode::Count;
+        while (offset < chunk.getCodeSize()) {
+            opcode = static_cast<OpCode>(chunk.getByte(offset));
+            // Quickened opcodes (AddNumber and after) are only written by the VM, they never come from a file.
+            if (opcode >= OpCode::AddNumber) return false;
+            isInstructionStart[offset] = true;
+            offset += getInstructionSize(opcode);
+        }
+        if (offset != chunk.getCodeSize() || opcode != OpCode::Return) return false;
+
+        // Operands have to refer to entries of the chunk's tables: jumps have to land on an instruction, loops have
+        // to have a counter, names have to be string constants. Locals are checked against the stack depth
+        // by Chunk::computeMaxStackDepth.
+        for (offset = 0; offset < chunk.getCodeSize(); offset += getInstructionSize(opcode)) {
+            opcode = static_cast<OpCode>(chunk.getByte(offset));
+            size_t size = getInstructionSize(opcode);
+            size_t index = size == 4 ? chunk.readLong(offset + 1) : size > 1 ? chunk.getByte(offset + 1) : 0;
+            switch (opcode)
+            {
+            case OpCode::Constant:
+            case OpCode::ConstantLong:
+            case OpCode::AddConstant:
+                if (index >= chunk.getConstantCount()) return false;
+                break;
+            case OpCode::DefGlobal:
+            case OpCode::DefGlobalLong:
+            case OpCode::GetGlobal:
+            case OpCode::GetGlobalLong:
+            case OpCode::SetGlobal:
+            case OpCode::SetGlobalLong:
+                if (index >= chunk.getConstantCount() || !chunk.getConstant(index).isString()) return false;
+                break;
+            case OpCode::DefGlobalSlot:
+            case OpCode::DefGlobalSlotLong:
+            case OpCode::GetGlobalSlot:
+            case OpCode::GetGlobalSlotLong:
+            case OpCode::SetGlobalSlot:
+            case OpCode::SetGlobalSlotLong:
+            case OpCode::PrintGlobalSlot:
+                if (index >= chunk.getGlobalNames().size()) return false;
+                break;
+            case OpCode::Jump:
+            case OpCode::JumpLong:
+            case OpCode::JumpIfFalse:
+            case OpCode::JumpIfFalseLong:
+            case OpCode::JumpIfTrue:
+            case OpCode::JumpIfTrueLong:
+            case OpCode::Loop:
+            case OpCode::LoopLong: {
+                size_t target = chunk.getJumpTarget(offset);
+                if (target >= chunk.getCodeSize() || !isInstructionStart[target]) return false;
+                if ((opcode == OpCode::Loop || opcode == OpCode::LoopLong) && chunk.getLoop(offset) >= chunk.getLoopCount())
+                    return false;
+            } break;
+            default:
+                break;
+            }
+        }
+        return true;
+    }
+
+} // namespace Lux
@@ -0,0 +1,43 @@
+#pragma once
+#include "common.hpp"
+
+#include <vector>
+
+namespace Lux {
+
+    class Chunk;
+    class Heap;
+
+    // Versioned binary format of a compiled chunk, all values are little-endian:
+    //  header      magic "LUXB", u16 version, u8 opcode count, u8 reserved,
+    //              u32 code size, u32 line runs, u32 constants, u32 globals, u32 loops
+    //  code        the chunk's bytecode as is
+    //  lines       per run: u32 line, u32 instruction bytes on that line
+    //  constants   per constant: u8 type, then nothing (nil), u8 (bool), u64 bits (number) or u32 length + chars (string)
+    //  globals     per global: u32 length + chars of its name
+    // Code is placed right after the fixed-size header so a loaded chunk can execute it in place.
+    class Bytecode
+    {
+    public:
+        static constexpr uint16_t VERSION = 2;
+        // The code starts right after the header.
+        static constexpr size_t HEADER_SIZE = 28;
+
+        static bool isBytecode(const uint8_t* data, size_t size);
+
+        static std::vector<uint8_t> serialize(const Chunk& chunk);
+        // The chunk executes code straight from data, which has to outlive it.
+        // Strings are interned in heap. Returns false if data isn't valid bytecode of this version.
+        static bool deserialize(const uint8_t* data, size_t size, Chunk& chunk, Heap& heap);
+    private:
+        enum class ConstantType : uint8_t {
+            Nil,
+            Bool,
+            Number,
+            String
+        };
+
+        static bool isCodeValid(const Chunk& chunk);
+    };
+
+} // namespace Lux
@@ -0,0 +1,79 @@
+#include "bytecode_cache.hpp"
+#include "bytecode.hpp"
+#include "chunk.hpp"
+#include "compiler.hpp"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <utility>
+
+// Hash of the sources that decide which code is generated, set by the build. Builds without it
+// rely on Compiler::CODEGEN_VERSION alone.
+#ifndef LUX_CODEGEN_HASH
+#define LUX_CODEGEN_HASH "0"
+#endif
+
+namespace Lux {
+
+    static uint64_t hashSource(const char* source, size_t length)
+    {
+        // 64-bit FNV-1a, together with the length it makes serving code of another script practically impossible.
+        uint64_t hash = 14695981039346656037ull;
+        for (size_t i = 0; i < length; i++) {
+            hash ^= static_cast<uint8_t>(source[i]);
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    BytecodeCache::BytecodeCache(std::string directory) :
+        m_directory{ std::move(directory) }
+    {}
+
+    std::unique_ptr<MappedFile> BytecodeCache::load(const char* source, int optimizationLevel, Chunk& chunk, Heap& heap) const
+    {
+        auto file = std::make_unique<MappedFile>(getPath(source, optimizationLevel).c_str());
+        if (file->isOpen() && Bytecode::deserialize(file->getData(), file->getSize(), chunk, heap))
+            return file;
+
+        chunk = {};
+        return nullptr;
+    }
+
+    bool BytecodeCache::store(const char* source, int optimizationLevel, const Chunk& chunk) const
+    {
+        std::error_code error;
+        std::filesystem::create_directories(m_directory, error);
+        if (error) return false;
+
+        std::string path = getPath(source, optimizationLevel);
+        std::string temporaryPath = path + ".tmp" + std::to_string(std::random_device{}());
+        std::vector<uint8_t> data = Bytecode::serialize(chunk);
+        {
+            std::ofstream fout(temporaryPath, std::ios::binary);
+            if (!fout.write(reinterpret_cast<const char*>(data.data()), data.size())) {
+                fout.close();
+                std::filesystem::remove(temporaryPath, error);
+                return false;
+            }
+        }
+
+        std::filesystem::rename(temporaryPath, path, error);
+        if (error) std::filesystem::remove(temporaryPath, error);
+        return !error;
+    }
+
+    std::string BytecodeCache::getPath(const char* source, int optimizationLevel) const
+    {
+        size_t length = std::strlen(source);
+        char name[128];
+        std::snprintf(name, sizeof(name), "%016llx-%zu-O%d-v%u-%u-c%u-%s.luxb",
+            static_cast<unsigned long long>(hashSource(source, length)), length, optimizationLevel,
+            static_cast<unsigned>(Bytecode::VERSION), static_cast<unsigned>(OpCode::Count),
+            static_cast<unsigned>(Compiler::CODEGEN_VERSION), LUX_CODEGEN_HASH);
+        return (std::filesystem::path{ m_directory } / name).string();
+    }
+
+} // namespace Lux
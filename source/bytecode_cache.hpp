@@ -0,0 +1,34 @@
+#pragma once
+#include "common.hpp"
+#include "mapped_file.hpp"
+
+#include <memory>
+#include <string>
+
+namespace Lux {
+
+    class Chunk;
+    class Heap;
+
+    // Directory of compiled chunks, one bytecode file per source. Files are named after a hash of
+    // the source and its length, the optimization level, the bytecode format and the code generator
+    // (its version and a hash of its sources), so a changed script or interpreter simply misses the
+    // cache. Stale files are never removed.
+    class BytecodeCache
+    {
+    public:
+        explicit BytecodeCache(std::string directory);
+
+        // Returns the mapped file the chunk executes from, it has to outlive the chunk.
+        // Returns nullptr and leaves the chunk empty on a miss.
+        std::unique_ptr<MappedFile> load(const char* source, int optimizationLevel, Chunk& chunk, Heap& heap) const;
+        // Best effort, the file is written under a temporary name and renamed
+        // so that other processes never load a partially written file.
+        bool store(const char* source, int optimizationLevel, const Chunk& chunk) const;
+    private:
+        std::string getPath(const char* source, int optimizationLevel) const;
+
+        std::string m_directory;
+    };
+
+} // namespace Lux
@@ -1,7 +1,58 @@
 #include "chunk.hpp"
 
+#include <algorithm>
+#include <bit>
+
 namespace Lux {
 
+    size_t getInstructionSize(OpCode opcode)
+    {
+        static constexpr uint8_t s_sizes[] = {
+#define LUX_OPCODE_SIZE(name, operands, stackEffect) 1 + operands,
+            LUX_OPCODES(LUX_OPCODE_SIZE)
+#undef LUX_OPCODE_SIZE
+        };
+        return s_sizes[static_cast<size_t>(opcode)];
+    }
+
+    int getStackEffect(OpCode opcode)
+    {
+        static constexpr int8_t s_effects[] = {
+#define LUX_OPCODE_EFFECT(name, operands, stackEffect) stackEffect,
+            LUX_OPCODES(LUX_OPCODE_EFFECT)
+#undef LUX_OPCODE_EFFECT
+        };
+        return s_effects[static_cast<size_t>(opcode)];
+    }
+
+    const char* getOpCodeName(OpCode opcode)
+    {
+        static constexpr const char* s_names[] = {
+#define LUX_OPCODE_NAME(name, operands, stackEffect) #name,
+            LUX_OPCODES(LUX_OPCODE_NAME)
+#undef LUX_OPCODE_NAME
+        };
+        return s_names[static_cast<size_t>(opcode)];
+    }
+
+    bool isJump(OpCode opcode)
+    {
+        switch (opcode)
+        {
+        case OpCode::Jump:
+        case OpCode::JumpLong:
+        case OpCode::JumpIfFalse:
+        case OpCode::JumpIfFalseLong:
+        case OpCode::JumpIfTrue:
+        case OpCode::JumpIfTrueLong:
+        case OpCode::Loop:
+        case OpCode::LoopLong:
+            return true;
+        default:
+            return false;
+        }
+    }
+
     void Chunk::write(uint8_t byte, size_t line)
     {
         m_code.emplace_back(byte);
@@ -12,21 +63,125 @@ namespace Lux {
             m_lines.emplace_back(line, 1);
     }
 
-    void Chunk::writeConstant(Value constant, size_t line, OpCode opcode, OpCode opcodeLong)
+    void Chunk::writeIndexed(size_t index, size_t line, OpCode opcode, OpCode opcodeLong)
     {
-        size_t constantIndex = addConstant(constant);
-        if (constantIndex >= 256)
+        if (index >= 256)
         {
             write((uint8_t)opcodeLong, line);
-            write(constantIndex % 256, line);
-            constantIndex /= 256;
-            write(constantIndex % 256, line);
-            constantIndex /= 256;
-            write(constantIndex % 256, line);
+            writeLong(index, line);
         }
         else {
             write((uint8_t)opcode, line);
-            write((uint8_t)constantIndex, line);
+            write((uint8_t)index, line);
+        }
+    }
+
+    void Chunk::writeConstant(Value constant, size_t line, OpCode opcode, OpCode opcodeLong)
+    {
+        writeIndexed(addConstant(constant), line, opcode, opcodeLong);
+    }
+
+    size_t Chunk::writeJump(OpCode opcodeLong, size_t line)
+    {
+        size_t offset = m_code.size();
+        write(static_cast<uint8_t>(opcodeLong), line);
+        writeLong(0, line);
+        return offset;
+    }
+
+    bool Chunk::patchJump(size_t offset)
+    {
+        size_t distance = m_code.size() - (offset + 4);
+        if (distance > MAX_LONG_INDEX) return false;
+
+        for (size_t i = 1; i <= 3; i++, distance /= 256)
+            m_code[offset + i] = distance % 256;
+        return true;
+    }
+
+    bool Chunk::writeLoop(size_t target, size_t loop, size_t line)
+    {
+        size_t distance = m_code.size() + 3 - target;
+        if (distance <= UINT8_MAX && loop <= UINT8_MAX) {
+            write(static_cast<uint8_t>(OpCode::Loop), line);
+            write(static_cast<uint8_t>(distance), line);
+            write(static_cast<uint8_t>(loop), line);
+            return true;
+        }
+
+        distance += 4;
+        if (distance > MAX_LONG_INDEX || loop > MAX_LONG_INDEX) return false;
+        write(static_cast<uint8_t>(OpCode::LoopLong), line);
+        writeLong(distance, line);
+        writeLong(loop, line);
+        return true;
+    }
+
+    void Chunk::moveToEnd(size_t from, size_t to)
+    {
+        if (from == to) return;
+
+        // The code from `from` on is rewritten byte by byte, write() merges the lines back into runs.
+        std::vector<std::pair<uint8_t, size_t>> bytes;
+        size_t runStart = 0;
+        for (const LineInfo& run : m_lines) {
+            for (size_t i = std::max(runStart, from); i < runStart + run.indexOffset; i++)
+                bytes.emplace_back(m_code[i], run.line);
+            runStart += run.indexOffset;
+        }
+
+        erase(from, m_code.size());
+        std::rotate(bytes.begin(), bytes.begin() + (to - from), bytes.end());
+        for (auto [byte, line] : bytes)
+            write(byte, line);
+    }
+
+    void Chunk::writeLong(size_t value, size_t line)
+    {
+        write(value % 256, line);
+        value /= 256;
+        write(value % 256, line);
+        value /= 256;
+        write(value % 256, line);
+    }
+
+    uint32_t Chunk::readLong(size_t index) const
+    {
+        return getByte(index) | (getByte(index + 1) << 8) | (getByte(index + 2) << 16);
+    }
+
+    void Chunk::setExternalCode(const uint8_t* code, size_t size)
+    {
+        m_code.clear();
+        m_externalCode = code;
+        m_externalCodeSize = size;
+    }
+
+    void Chunk::erase(size_t from, size_t to)
+    {
+        m_code.erase(m_code.begin() + from, m_code.begin() + to);
+
+        size_t remaining = to - from;
+        size_t runStart = 0;
+        for (size_t i = 0; i < m_lines.size() && remaining > 0;)
+        {
+            LineInfo& run = m_lines[i];
+            size_t runEnd = runStart + run.indexOffset;
+            if (runEnd <= from) {
+                runStart = runEnd;
+                i++;
+                continue;
+            }
+
+            size_t removed = std::min(runEnd, from + remaining) - std::max(from, runStart);
+            run.indexOffset -= removed;
+            remaining -= removed;
+            if (run.indexOffset == 0)
+                m_lines.erase(m_lines.begin() + i);
+            else {
+                runStart += run.indexOffset;
+                i++;
+            }
         }
     }
 
@@ -44,10 +199,120 @@ namespace Lux {
         return m_lines[i].line;
     }
 
+    bool Chunk::computeMaxStackDepth()
+    {
+        // Every statement leaves the stack balanced, so a linear walk over the code gives the maximum depth
+        // the chunk can ever reach, as long as every jump lands on the same depth the code at its target has.
+        constexpr size_t NOT_TARGET = SIZE_MAX;
+        constexpr size_t UNKNOWN = SIZE_MAX - 1;
+        std::vector<size_t> targetDepths(getCodeSize(), NOT_TARGET);
+        for (size_t offset = 0; offset < getCodeSize();) {
+            OpCode opcode = static_cast<OpCode>(getByte(offset));
+            if (isJump(opcode)) targetDepths[getJumpTarget(offset)] = UNKNOWN;
+            offset += getInstructionSize(opcode);
+        }
+
+        m_maxStackDepth = SIZE_MAX;
+        m_maxStackDepthOffset = 0;
+        size_t maxDepth = 0;
+        size_t depth = 0;
+        bool isReachable = true; // false right after an unconditional jump, the next depth comes from jumps to it
+        for (size_t offset = 0; offset < getCodeSize();)
+        {
+            OpCode opcode = static_cast<OpCode>(getByte(offset));
+            if (size_t& targetDepth = targetDepths[offset]; targetDepth != NOT_TARGET) {
+                if (targetDepth == UNKNOWN) targetDepth = depth;
+                else if (!isReachable) depth = targetDepth;
+                else if (targetDepth != depth) return false;
+            }
+
+            // Locals live below the temporaries, anything at or above the top isn't there.
+            switch (opcode)
+            {
+            case OpCode::GetLocal:
+            case OpCode::SetLocal:
+                if (getByte(offset + 1) >= depth) return false;
+                break;
+            case OpCode::GetLocalLong:
+            case OpCode::SetLocalLong:
+                if (readLong(offset + 1) >= depth) return false;
+                break;
+            case OpCode::GetLocalPair:
+            case OpCode::AddLocals:
+            case OpCode::AddLocalsNumber:
+                if (std::max(getByte(offset + 1), getByte(offset + 2)) >= depth) return false;
+                break;
+            default:
+                break;
+            }
+
+            size_t popped = opcode == OpCode::PopN ? getByte(offset + 1) : 0;
+            int effect = getStackEffect(opcode);
+            if (effect < 0) popped -= effect;
+            if (popped > depth) return false;
+            depth = depth - popped + std::max(effect, 0);
+            if (depth > maxDepth) {
+                maxDepth = depth;
+                m_maxStackDepthOffset = offset;
+            }
+
+            if (isJump(opcode)) {
+                size_t& targetDepth = targetDepths[getJumpTarget(offset)];
+                if (targetDepth == UNKNOWN) targetDepth = depth;
+                else if (targetDepth != depth) return false;
+            }
+            isReachable = opcode != OpCode::Jump && opcode != OpCode::JumpLong &&
+                opcode != OpCode::Loop && opcode != OpCode::LoopLong && opcode != OpCode::Return;
+            offset += getInstructionSize(opcode);
+        }
+
+        m_maxStackDepth = maxDepth;
+        return true;
+    }
+
+    size_t Chunk::getJumpTarget(size_t offset) const
+    {
+        OpCode opcode = static_cast<OpCode>(getByte(offset));
+        size_t end = offset + getInstructionSize(opcode);
+        switch (opcode)
+        {
+        case OpCode::Jump:
+        case OpCode::JumpIfFalse:
+        case OpCode::JumpIfTrue:      return end + getByte(offset + 1);
+        case OpCode::JumpLong:
+        case OpCode::JumpIfFalseLong:
+        case OpCode::JumpIfTrueLong:  return end + readLong(offset + 1);
+        case OpCode::Loop:            return end - getByte(offset + 1);
+        case OpCode::LoopLong:        return end - readLong(offset + 1);
+        default:                      return end;
+        }
+    }
+
+    uint32_t Chunk::getLoop(size_t offset) const
+    {
+        return static_cast<OpCode>(getByte(offset)) == OpCode::Loop ? getByte(offset + 2) : readLong(offset + 4);
+    }
+
     size_t Chunk::addConstant(Value value)
     {
+        if (value.isNumber()) {
+            // Keyed by bits so that 0 and -0 stay distinct; NaNs are deduplicated by payload as well.
+            auto [it, inserted] = m_numberConstants.try_emplace(std::bit_cast<uint64_t>(value.asNumber()), m_constants.size());
+            if (!inserted) return it->second;
+        }
+        else if (value.isObject()) {
+            auto [it, inserted] = m_objectConstants.try_emplace(value.asObject(), m_constants.size());
+            if (!inserted) return it->second;
+        }
+
         m_constants.emplace_back(value);
         return m_constants.size() - 1;
     }
 
+    size_t Chunk::addGlobal(String* name)
+    {
+        m_globalNames.emplace_back(name);
+        return m_globalNames.size() - 1;
+    }
+
 } // namespace Lux
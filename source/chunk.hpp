@@ -2,63 +2,176 @@
 #include "types/value.hpp"
 
 #include <cstdint>
+#include <unordered_map>
 #include <vector>
 
 namespace Lux {
 
+    class String;
+
+// X(name, operand bytes, stack effect), stack effect of PopN depends on its operand.
+// Jump distances are counted from the end of the jump instruction. Jump, JumpIfFalse and JumpIfTrue go forward,
+// the conditional ones leave the condition on the stack. Loop jumps back by its first operand and counts the jump
+// in the backedge counter of the loop numbered by its second one, LoopLong has 3 bytes for each operand.
+// Opcodes after Return are superinstructions, each one does the work of the sequence in its comment
+// and is only emitted by the Optimizer.
+// Opcodes after NotLess are quickened forms of the opcode in their comment, specialized to the
+// operand types in their name. Only the VM writes them, to code nobody else runs (see VM::execute), and they
+// are the last opcodes so bytecode files can reject them.
+#define LUX_OPCODES(X)          \
+    X(Constant,       1, +1)    \
+    X(ConstantLong,   3, +1)    \
+    X(DefGlobal,      1, -1)    \
+    X(DefGlobalLong,  3, -1)    \
+    X(GetGlobal,      1, +1)    \
+    X(GetGlobalLong,  3, +1)    \
+    X(SetGlobal,      1,  0)    \
+    X(SetGlobalLong,  3,  0)    \
+    X(DefGlobalSlot,  1, -1)    \
+    X(DefGlobalSlotLong, 3, -1) \
+    X(GetGlobalSlot,  1, +1)    \
+    X(GetGlobalSlotLong, 3, +1) \
+    X(SetGlobalSlot,  1,  0)    \
+    X(SetGlobalSlotLong, 3,  0) \
+    X(GetLocal,       1, +1)    \
+    X(GetLocalLong,   3, +1)    \
+    X(SetLocal,       1,  0)    \
+    X(SetLocalLong,   3,  0)    \
+    X(Nil,            0, +1)    \
+    X(True,           0, +1)    \
+    X(False,          0, +1)    \
+    X(Negate,         0,  0)    \
+    X(Add,            0, -1)    \
+    X(Subtract,       0, -1)    \
+    X(Multiply,       0, -1)    \
+    X(Divide,         0, -1)    \
+    X(Not,            0,  0)    \
+    X(Equal,          0, -1)    \
+    X(NotEqual,       0, -1)    \
+    X(Less,           0, -1)    \
+    X(LessEqual,      0, -1)    \
+    X(Greater,        0, -1)    \
+    X(GreaterEqual,   0, -1)    \
+    X(Print,          0, -1)    \
+    X(Pop,            0, -1)    \
+    X(PopN,           1,  0)    \
+    X(Jump,           1,  0)    \
+    X(JumpLong,       3,  0)    \
+    X(JumpIfFalse,    1,  0)    \
+    X(JumpIfFalseLong, 3, 0)    \
+    X(JumpIfTrue,     1,  0)    \
+    X(JumpIfTrueLong, 3,  0)    \
+    X(Loop,           2,  0)    \
+    X(LoopLong,       6,  0)    \
+    X(Return,         0,  0)    \
+    X(GetLocalPair,   2, +2) /* GetLocal a; GetLocal b    */ \
+    X(AddLocals,      2, +1) /* GetLocal a; GetLocal b; Add */ \
+    X(AddConstant,    1,  0) /* Constant k; Add           */ \
+    X(PrintGlobalSlot, 1, 0) /* GetGlobalSlot s; Print    */ \
+    X(NotLess,        0, -1) /* Less; Not                 */ \
+    X(AddNumber,      0, -1) /* Add                       */ \
+    X(AddLocalsNumber, 2, +1) /* AddLocals                */ \
+    X(AddConstantNumber, 1, 0) /* AddConstant             */ \
+    X(EqualNumber,    0, -1) /* Equal                     */ \
+    X(NotEqualNumber, 0, -1) /* NotEqual                  */
+
+    // Order of opcodes is defined once in LUX_OPCODES so that
+    // tables indexed by opcode (e.g. VM dispatch table) can't get out of sync.
     enum class OpCode : uint8_t {
-        Constant,
-        ConstantLong,
-        DefGlobal,
-        DefGlobalLong,
-        GetGlobal,
-        GetGlobalLong,
-        SetGlobal,
-        SetGlobalLong,
-        GetLocal,
-        SetLocal,
-        Nil,
-        True,
-        False,
-        Negate,
-        Add,
-        Subtract,
-        Multiply,
-        Divide,
-        Not,
-        Equal,
-        NotEqual,
-        Less,
-        LessEqual,
-        Greater,
-        GreaterEqual,
-        Print,
-        Pop,
-        Return
+#define LUX_OPCODE_ENUM(name, operands, stackEffect) name,
+        LUX_OPCODES(LUX_OPCODE_ENUM)
+#undef LUX_OPCODE_ENUM
+        Count
     };
 
+    size_t getInstructionSize(OpCode opcode);
+    int getStackEffect(OpCode opcode);
+    const char* getOpCodeName(OpCode opcode);
+    bool isJump(OpCode opcode);
+
     class Chunk
     {
     public:
         void write(uint8_t byte, size_t line);
+        // Operands that don't fit in one byte are written as 3 bytes (little-endian) after opcodeLong.
+        void writeIndexed(size_t index, size_t line, OpCode opcode, OpCode opcodeLong);
         void writeConstant(Value constant, size_t line, OpCode opcode, OpCode opcodeLong);
+        // Forward jumps are written in their long form with the distance left out, returns the offset of the jump
+        // to patch once the code it jumps to is written. Patching fails if the distance doesn't fit in 3 bytes.
+        size_t writeJump(OpCode opcodeLong, size_t line);
+        bool patchJump(size_t offset);
+        // Jumps back to target, fails if it's too far.
+        bool writeLoop(size_t target, size_t loop, size_t line);
+        // Moves code in [from, to) to the end of the chunk, with its lines. Jumps in the moved code and in the code
+        // after it must not leave their part.
+        void moveToEnd(size_t from, size_t to);
+        // Removes code in [from, to), lines of the remaining code are kept.
+        void erase(size_t from, size_t to);
 
-        const uint8_t* getCodeRawPtr() const { return m_code.data(); }
-        size_t getCodeSize() const { return m_code.size(); }
-        uint8_t getByte(size_t index) const { return m_code[index]; }
+        // Makes the chunk execute code it doesn't own (e.g. a memory-mapped bytecode file) instead of its own.
+        // The code has to outlive the chunk, and such chunk can't be written to anymore.
+        void setExternalCode(const uint8_t* code, size_t size);
+        bool hasExternalCode() const { return m_externalCode != nullptr; }
+
+        const uint8_t* getCodeRawPtr() const { return m_externalCode ? m_externalCode : m_code.data(); }
+        // Code that can be modified in place (see VM quickening), nullptr for external code.
+        uint8_t* getOwnCode() { return m_externalCode ? nullptr : m_code.data(); }
+        size_t getCodeSize() const { return m_externalCode ? m_externalCodeSize : m_code.size(); }
+        uint8_t getByte(size_t index) const { return getCodeRawPtr()[index]; }
         size_t getLine(size_t index) const;
+        // Finds the deepest the stack gets while the code runs, so the VM checks a chunk against its stack capacity
+        // without walking the code. The Compiler, Optimizer and Bytecode call it once the code is complete, code
+        // written by hand has to call it too. Fails if a jump lands on a different depth than the code at its target
+        // has, the code pops more than it pushed or it accesses a local that isn't on the stack (only a hand-written
+        // bytecode file can).
+        bool computeMaxStackDepth();
+        // SIZE_MAX until computeMaxStackDepth() succeeds, so such a chunk never fits in the stack.
+        size_t getMaxStackDepth() const { return m_maxStackDepth; }
+        // First instruction that reaches the maximum depth.
+        size_t getMaxStackDepthOffset() const { return m_maxStackDepthOffset; }
+        // Offset the jump instruction at offset continues at when it's taken.
+        size_t getJumpTarget(size_t offset) const;
+        uint32_t getLoop(size_t offset) const;
+
+        static constexpr size_t MAX_LONG_INDEX = (1 << 24) - 1;
 
+        // Equal numbers and the same object (strings are interned) share one constant.
         size_t addConstant(Value value);
         Value getConstant(size_t index) const { return m_constants[index]; }
+        size_t getConstantCount() const { return m_constants.size(); }
+
+        // Globals resolved at compile time are addressed by slot, names are kept for error messages
+        // and so that globals referenced by name can be bound to the same slots.
+        size_t addGlobal(String* name);
+        const std::vector<String*>& getGlobalNames() const { return m_globalNames; }
+
+        // Loops are numbered in the order they appear in the source, each one has its own backedge counter
+        // in the VM (see VM::getBackedgeCounts).
+        size_t addLoop() { return m_loopCount++; }
+        size_t getLoopCount() const { return m_loopCount; }
     private:
+        friend class Optimizer;
+        friend class Bytecode;
+
         struct LineInfo {
             size_t line;
             size_t indexOffset;
         };
 
+        void writeLong(size_t value, size_t line);
+        uint32_t readLong(size_t index) const;
+
         std::vector<uint8_t> m_code;
+        const uint8_t* m_externalCode = nullptr;
+        size_t m_externalCodeSize = 0;
         std::vector<LineInfo> m_lines;
         std::vector<Value> m_constants;
+        std::unordered_map<uint64_t, size_t> m_numberConstants; // bit pattern -> index
+        std::unordered_map<const Object*, size_t> m_objectConstants;
+        std::vector<String*> m_globalNames;
+        size_t m_loopCount = 0;
+        size_t m_maxStackDepth = SIZE_MAX;
+        size_t m_maxStackDepthOffset = 0;
     };
 
 } // namespace Lux
@@ -1,5 +1,7 @@
 #pragma once
+#include <cstddef>
 #include <cstdint>
+#include <cstdio>
 
 //#define DEBUG_PRINT_CODE
 //#define DEBUG_TRACE_EXECUTION
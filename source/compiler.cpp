@@ -1,21 +1,36 @@
 #include "compiler.hpp"
 #include "chunk.hpp"
+#include "heap.hpp"
 #include "types/string.hpp"
 
+#include <bit>
+
 #ifdef DEBUG_PRINT_CODE
 #include "debug.hpp"
 #endif
 
 namespace Lux {
 
-    bool Compiler::compile(const char *source, Chunk &chunk)
+    bool Compiler::compile(const char *source, Chunk &chunk, Heap &heap)
     {
-        reset(source, chunk);
+        reset(source, nullptr, chunk, heap);
+        return compileSource();
+    }
 
+    bool Compiler::compile(String* source, Chunk& chunk, Heap& heap)
+    {
+        reset(source->data(), source, chunk, heap);
+        return compileSource();
+    }
+
+    bool Compiler::compileSource()
+    {
         advance();
         while (!match(Token::Type::EndOfFile)) declaration();
         
         emitByte(static_cast<uint8_t>(OpCode::Return));
+        // Compiled code always keeps the stack consistent, so this can't fail.
+        currentChunk().computeMaxStackDepth();
 
 #ifdef DEBUG_PRINT_CODE
         if (!m_hadError) disassembleChunk(currentChunk(), "code");
@@ -24,15 +39,26 @@ namespace Lux {
         return !m_hadError;
     }
 
-    void Compiler::reset(const char* source, Chunk& chunk)
+    void Compiler::reset(const char* source, String* sourceString, Chunk& chunk, Heap& heap)
     {
         m_scanner = std::make_unique<Scanner>(source);
         m_currentChunk = &chunk;
+        m_heap = &heap;
+        m_source = source;
+        m_sourceString = sourceString;
         m_hadError = false;
         m_panicMode = false;
 
         m_scopeDepth = 0;
-        m_localCount = 0;
+        m_locals.clear();
+        m_globals.clear();
+    }
+
+    String* Compiler::makeString(const char* start, size_t length)
+    {
+        // Strings that were interned before are reused either way.
+        if (!m_sourceString) return m_heap->makeString(start, length);
+        return m_heap->makeSlice(m_sourceString, start - m_source, length);
     }
 
     void Compiler::advance()
@@ -83,16 +109,15 @@ namespace Lux {
 
         String* str = nullptr;
         if (m_scopeDepth == 0) { // Define global
-            // TODO: memory leak
-            str = String::create(m_previous.start, m_previous.length);
+            str = makeString(m_previous.start, m_previous.length);
         }
         else { // Declare local
-            if (m_localCount == 256) {
+            if (m_locals.size() == MAX_LOCALS) {
                 error("Too many local variables in function.");
                 return;
             }
 
-            for (int i = m_localCount - 1; i >= 0; i--) {
+            for (size_t i = m_locals.size(); i-- > 0;) {
                 Local& local = m_locals[i];
                 if (local.depth != -1 && local.depth < m_scopeDepth) {
                     break;
@@ -103,35 +128,31 @@ namespace Lux {
                 }
             }
 
-            m_locals[m_localCount].name = m_previous;
-            m_locals[m_localCount].depth = -1; // mark variable as not ready for use...
-            m_localCount++;
+            m_locals.emplace_back(m_previous, -1); // mark variable as not ready for use...
         }
 
         match(Token::Type::Equal) ? expression() : emitByte(static_cast<uint8_t>(OpCode::Nil));
         consume(Token::Type::Semicolon, "Expect ';' after variable declaration.");
 
-        m_locals[m_localCount - 1].depth = m_scopeDepth; // ...and after initiazlization expression mark as ready
+        if (!str) m_locals.back().depth = m_scopeDepth; // ...and after initiazlization expression mark as ready
 
-        if (str) emitDefGlobal(Value::makeObject(str));
+        if (str) emitDefGlobal(str);
     }
 
     void Compiler::statement()
     {
         if (match(Token::Type::Print))
             printStatement();
+        else if (match(Token::Type::If))
+            ifStatement();
+        else if (match(Token::Type::While))
+            whileStatement();
+        else if (match(Token::Type::For))
+            forStatement();
         else if (match(Token::Type::LeftBrace)) {
-            // begin scope
-            m_scopeDepth++;
-            
+            beginScope();
             block();
-
-            // end scope
-            m_scopeDepth--;
-            while (m_localCount > 0 && m_locals[m_localCount - 1].depth > m_scopeDepth) {
-                emitByte(static_cast<uint8_t>(OpCode::Pop)); // TODO: add PopN to optimize when >1 pop
-                m_localCount--;
-            }
+            endScope();
         }
         else
             expressionStatement();
@@ -146,6 +167,20 @@ namespace Lux {
         consume(Token::Type::RightBrace, "Expect '}' after block.");
     }
 
+    void Compiler::beginScope()
+    {
+        m_scopeDepth++;
+    }
+
+    void Compiler::endScope()
+    {
+        m_scopeDepth--;
+        while (!m_locals.empty() && m_locals.back().depth > m_scopeDepth) {
+            emitByte(static_cast<uint8_t>(OpCode::Pop)); // Optimizer merges these into PopN
+            m_locals.pop_back();
+        }
+    }
+
     void Compiler::printStatement()
     {
         expression();
@@ -153,6 +188,85 @@ namespace Lux {
         emitByte(static_cast<uint8_t>(OpCode::Print));
     }
 
+    void Compiler::ifStatement()
+    {
+        consume(Token::Type::LeftParen, "Expect '(' after 'if'.");
+        expression();
+        consume(Token::Type::RightParen, "Expect ')' after condition.");
+
+        // Conditional jumps leave the condition on the stack, each branch pops it.
+        size_t thenJump = emitJump(OpCode::JumpIfFalseLong);
+        emitByte(static_cast<uint8_t>(OpCode::Pop));
+        statement();
+
+        size_t elseJump = emitJump(OpCode::JumpLong);
+        patchJump(thenJump);
+        emitByte(static_cast<uint8_t>(OpCode::Pop));
+        if (match(Token::Type::Else)) statement();
+        patchJump(elseJump);
+    }
+
+    void Compiler::whileStatement()
+    {
+        size_t loop = currentChunk().addLoop();
+        size_t loopStart = currentChunk().getCodeSize();
+        consume(Token::Type::LeftParen, "Expect '(' after 'while'.");
+        expression();
+        consume(Token::Type::RightParen, "Expect ')' after condition.");
+
+        size_t exitJump = emitJump(OpCode::JumpIfFalseLong);
+        emitByte(static_cast<uint8_t>(OpCode::Pop));
+        statement();
+        emitLoop(loopStart, loop);
+
+        patchJump(exitJump);
+        emitByte(static_cast<uint8_t>(OpCode::Pop));
+    }
+
+    void Compiler::forStatement()
+    {
+        beginScope();
+        consume(Token::Type::LeftParen, "Expect '(' after 'for'.");
+        if (match(Token::Type::Semicolon)) {
+            // No initializer.
+        }
+        else if (match(Token::Type::Var))
+            varDeclaration();
+        else
+            expressionStatement();
+
+        size_t loop = currentChunk().addLoop();
+        size_t loopStart = currentChunk().getCodeSize();
+        bool hasCondition = !match(Token::Type::Semicolon);
+        size_t exitJump = 0;
+        if (hasCondition) {
+            expression();
+            consume(Token::Type::Semicolon, "Expect ';' after loop condition.");
+            exitJump = emitJump(OpCode::JumpIfFalseLong);
+            emitByte(static_cast<uint8_t>(OpCode::Pop));
+        }
+
+        size_t incrementStart = currentChunk().getCodeSize();
+        if (!match(Token::Type::RightParen)) {
+            expression();
+            emitByte(static_cast<uint8_t>(OpCode::Pop));
+            consume(Token::Type::RightParen, "Expect ')' after for clauses.");
+        }
+        size_t incrementEnd = currentChunk().getCodeSize();
+
+        statement();
+        // The increment is compiled before the body but runs after it, moving it behind the body
+        // leaves one jump back per iteration instead of a jump over the increment and two back.
+        currentChunk().moveToEnd(incrementStart, incrementEnd);
+        emitLoop(loopStart, loop);
+
+        if (hasCondition) {
+            patchJump(exitJump);
+            emitByte(static_cast<uint8_t>(OpCode::Pop));
+        }
+        endScope();
+    }
+
     void Compiler::expressionStatement()
     {
         expression();
@@ -175,12 +289,15 @@ namespace Lux {
         }
 
         bool canAssign = precedence <= Precedence::Assignment;
+        size_t start = currentChunk().getCodeSize();
         prefixRule(*this, canAssign);
+        m_expression.start = start;
 
         while (precedence <= getRule(m_current.type).precedence) {
             advance();
             ParseRule::ParseFn infixRule = getRule(m_previous.type).infix;
             infixRule(*this, canAssign);
+            m_expression.start = start;
         }
 
         if (canAssign && match(Token::Type::Equal)) {
@@ -191,30 +308,29 @@ namespace Lux {
     void Compiler::number(Compiler &c, bool canAssign)
     {
         double number = std::strtod(c.m_previous.start, nullptr);
-        c.emitConstant(Value::makeNumber(number));
+        c.emitValue(Value::makeNumber(number));
     }
 
     void Compiler::literal(Compiler &c, bool canAssign)
     {
         switch (c.m_previous.type) {
-        case Token::Type::False: c.emitByte(static_cast<uint8_t>(OpCode::False)); break;
-        case Token::Type::Nil: c.emitByte(static_cast<uint8_t>(OpCode::Nil)); break;
-        case Token::Type::True: c.emitByte(static_cast<uint8_t>(OpCode::True)); break;
+        case Token::Type::False: c.emitValue(Value::makeBool(false)); break;
+        case Token::Type::Nil: c.emitValue(Value::makeNil()); break;
+        case Token::Type::True: c.emitValue(Value::makeBool(true)); break;
         }
     }
 
     void Compiler::string(Compiler &c, bool canAssign)
     {
-        // TODO: memory leak
-        String *str = String::create(c.m_previous.start + 1, c.m_previous.length - 2);
-        c.emitConstant(Value::makeObject(str));
+        String *str = c.makeString(c.m_previous.start + 1, c.m_previous.length - 2);
+        c.emitValue(Value::makeObject(str));
     }
 
     void Compiler::variable(Compiler& c, bool canAssign)
     {
-        int i;
+        size_t i;
         bool isLocal = false;
-        for (i = c.m_localCount - 1; i >= 0; i--) {
+        for (i = c.m_locals.size(); i-- > 0;) {
             if (c.m_locals[i].name == c.m_previous) {
                 if (c.m_locals[i].depth == -1) {
                     c.error("Can't read local variable in its own initializer.");
@@ -226,16 +342,17 @@ namespace Lux {
 
         String* str = nullptr;
         if (!isLocal) {
-            // TODO: memory leak
-            str = String::create(c.m_previous.start, c.m_previous.length);
+            str = c.makeString(c.m_previous.start, c.m_previous.length);
         }
 
         if (canAssign && c.match(Token::Type::Equal)) {
             c.expression();
-            str ? c.emitSetGlobal(Value::makeObject(str)) : c.emitSetLocal(i);
+            str ? c.emitSetGlobal(str) : c.emitSetLocal(i);
         } 
         else
-            str ? c.emitGetGlobal(Value::makeObject(str)) : c.emitGetLocal(i);
+            str ? c.emitGetGlobal(str) : c.emitGetLocal(i);
+
+        c.m_expression = {};
     }
 
     void Compiler::grouping(Compiler &c, bool canAssign)
@@ -250,18 +367,29 @@ namespace Lux {
 
         // Compile the operand.
         c.parsePrecedence(Precedence::Unary);
+        if (c.foldUnary(operatorType, c.m_expression)) return;
 
         switch (operatorType) {
         case Token::Type::Minus: c.emitByte(static_cast<uint8_t>(OpCode::Negate)); break;
         case Token::Type::Bang: c.emitByte(static_cast<uint8_t>(OpCode::Not)); break;
         }
+
+        // Negating a number twice and inverting a bool twice gives back the operand.
+        Value::Type operandType = c.m_expression.type;
+        c.m_expression = {};
+        c.m_expression.type = operatorType == Token::Type::Minus ? Value::Type::Number : Value::Type::Bool;
+        if ((operatorType == Token::Type::Minus && operandType == Value::Type::Number) ||
+            (operatorType == Token::Type::Bang && operandType == Value::Type::Bool))
+            c.m_expression.selfInverse = operatorType;
     }
 
     void Compiler::binary(Compiler &c, bool canAssign)
     {
         Token::Type operatorType = c.m_previous.type;
         ParseRule& rule = getRule(operatorType);
+        ExpressionInfo lhs = c.m_expression;
         c.parsePrecedence(static_cast<Precedence>((static_cast<int>(rule.precedence) + 1)));
+        if (c.foldBinary(operatorType, lhs, c.m_expression)) return;
 
         switch (operatorType) {
         case Token::Type::BangEqual:    c.emitByte(static_cast<uint8_t>(OpCode::NotEqual));     break;
@@ -275,6 +403,137 @@ namespace Lux {
         case Token::Type::Star:         c.emitByte(static_cast<uint8_t>(OpCode::Multiply));     break;
         case Token::Type::Slash:        c.emitByte(static_cast<uint8_t>(OpCode::Divide));       break;
         }
+
+        c.m_expression = {};
+        switch (operatorType) {
+        case Token::Type::Plus: break; // Numbers or strings.
+        case Token::Type::Minus:
+        case Token::Type::Star:
+        case Token::Type::Slash: c.m_expression.type = Value::Type::Number; break;
+        default:                 c.m_expression.type = Value::Type::Bool; break;
+        }
+    }
+
+    void Compiler::logicalAnd(Compiler& c, bool canAssign)
+    {
+        // If the left operand is false it's the result, otherwise it's popped and the right operand is the result.
+        size_t endJump = c.emitJump(OpCode::JumpIfFalseLong);
+        c.emitByte(static_cast<uint8_t>(OpCode::Pop));
+        c.parsePrecedence(Precedence::And);
+        c.patchJump(endJump);
+
+        // The result is either operand, and the code can't be folded away with the jump in it.
+        c.m_expression = {};
+    }
+
+    void Compiler::logicalOr(Compiler& c, bool canAssign)
+    {
+        size_t endJump = c.emitJump(OpCode::JumpIfTrueLong);
+        c.emitByte(static_cast<uint8_t>(OpCode::Pop));
+        c.parsePrecedence(Precedence::Or);
+        c.patchJump(endJump);
+
+        c.m_expression = {};
+    }
+
+    // Folding only happens when the result is the same as at runtime, operands with wrong types
+    // are left for the VM to report.
+    bool Compiler::foldUnary(Token::Type operatorType, const ExpressionInfo& operand)
+    {
+        Value result;
+        if (operand.isConstant && evaluateUnary(operatorType, operand.value, result)) {
+            currentChunk().erase(operand.start, currentChunk().getCodeSize());
+            emitValue(result);
+            return true;
+        }
+
+        if (operand.selfInverse == operatorType) {
+            // Drop the operator that was applied to the operand, its result has the same type as the operand.
+            currentChunk().erase(currentChunk().getCodeSize() - 1, currentChunk().getCodeSize());
+            m_expression = {};
+            m_expression.type = operand.type;
+            return true;
+        }
+
+        return false;
+    }
+
+    bool Compiler::foldBinary(Token::Type operatorType, const ExpressionInfo& lhs, const ExpressionInfo& rhs)
+    {
+        Value result;
+        if (lhs.isConstant && rhs.isConstant && evaluateBinary(operatorType, lhs.value, rhs.value, result)) {
+            currentChunk().erase(lhs.start, currentChunk().getCodeSize());
+            emitValue(result);
+            return true;
+        }
+
+        // x * 1, x / 1 and x - 0 are x for every number x (but x + 0 isn't for x = -0).
+        auto isNumber = [](const ExpressionInfo& expression, double number) {
+            return expression.isConstant && expression.value.isNumber() &&
+                std::bit_cast<uint64_t>(expression.value.asNumber()) == std::bit_cast<uint64_t>(number);
+        };
+        if (lhs.type == Value::Type::Number &&
+            (((operatorType == Token::Type::Star || operatorType == Token::Type::Slash) && isNumber(rhs, 1.0)) ||
+             (operatorType == Token::Type::Minus && isNumber(rhs, 0.0)))) {
+            currentChunk().erase(rhs.start, currentChunk().getCodeSize());
+            m_expression = lhs;
+            return true;
+        }
+        if (rhs.type == Value::Type::Number && operatorType == Token::Type::Star && isNumber(lhs, 1.0)) {
+            currentChunk().erase(lhs.start, rhs.start);
+            m_expression = {};
+            m_expression.type = Value::Type::Number;
+            return true;
+        }
+
+        return false;
+    }
+
+    bool Compiler::evaluateUnary(Token::Type operatorType, Value operand, Value& result)
+    {
+        switch (operatorType) {
+        case Token::Type::Minus:
+            if (!operand.isNumber()) return false;
+            result = Value::makeNumber(-operand.asNumber());
+            return true;
+        case Token::Type::Bang:
+            result = Value::makeBool(!operand);
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    bool Compiler::evaluateBinary(Token::Type operatorType, Value lhs, Value rhs, Value& result)
+    {
+        switch (operatorType) {
+        case Token::Type::EqualEqual: result = Value::makeBool(lhs == rhs); return true;
+        case Token::Type::BangEqual:  result = Value::makeBool(lhs != rhs); return true;
+        case Token::Type::Plus:
+            if (lhs.isString() && rhs.isString()) {
+                result = Value::makeObject(m_heap->concatenate(*lhs.asObject()->asString(), *rhs.asObject()->asString()));
+                return true;
+            }
+            break;
+        default:
+            break;
+        }
+
+        if (!lhs.isNumber() || !rhs.isNumber()) return false;
+
+        double a = lhs.asNumber();
+        double b = rhs.asNumber();
+        switch (operatorType) {
+        case Token::Type::Plus:         result = Value::makeNumber(a + b); return true;
+        case Token::Type::Minus:        result = Value::makeNumber(a - b); return true;
+        case Token::Type::Star:         result = Value::makeNumber(a * b); return true;
+        case Token::Type::Slash:        result = Value::makeNumber(a / b); return true;
+        case Token::Type::Greater:      result = Value::makeBool(a > b);   return true;
+        case Token::Type::GreaterEqual: result = Value::makeBool(a >= b);  return true;
+        case Token::Type::Less:         result = Value::makeBool(a < b);   return true;
+        case Token::Type::LessEqual:    result = Value::makeBool(a <= b);  return true;
+        default:                        return false;
+        }
     }
 
     // TODO: make emiting opcodes easier
@@ -288,31 +547,76 @@ namespace Lux {
         currentChunk().writeConstant(constant, m_previous.line, OpCode::Constant, OpCode::ConstantLong);
     }
 
-    void Compiler::emitDefGlobal(Value global)
+    void Compiler::emitValue(Value value)
+    {
+        size_t start = currentChunk().getCodeSize();
+        if (value.isNil())
+            emitByte(static_cast<uint8_t>(OpCode::Nil));
+        else if (value.isBool())
+            emitByte(static_cast<uint8_t>(value.asBool() ? OpCode::True : OpCode::False));
+        else
+            emitConstant(value);
+
+        m_expression = {};
+        m_expression.start = start;
+        m_expression.isConstant = true;
+        m_expression.value = value;
+        m_expression.type = value.getType();
+    }
+
+    void Compiler::emitDefGlobal(String* name)
+    {
+        emitGlobal(name, OpCode::DefGlobalSlot, OpCode::DefGlobalSlotLong);
+    }
+
+    void Compiler::emitGetGlobal(String* name)
+    {
+        emitGlobal(name, OpCode::GetGlobalSlot, OpCode::GetGlobalSlotLong);
+    }
+
+    void Compiler::emitSetGlobal(String* name)
+    {
+        emitGlobal(name, OpCode::SetGlobalSlot, OpCode::SetGlobalSlotLong);
+    }
+
+    void Compiler::emitGlobal(String* name, OpCode opcode, OpCode opcodeLong)
+    {
+        currentChunk().writeIndexed(resolveGlobal(name), m_previous.line, opcode, opcodeLong);
+    }
+
+    size_t Compiler::resolveGlobal(String* name)
+    {
+        const HashTable::Entry* entry = m_globals.find(name);
+        if (entry) return static_cast<size_t>(entry->value.asNumber());
+
+        size_t slot = currentChunk().addGlobal(name);
+        m_globals.insert(name, Value::makeNumber(static_cast<double>(slot)));
+        return slot;
+    }
+
+    void Compiler::emitGetLocal(size_t index)
     {
-        currentChunk().writeConstant(global, m_previous.line, OpCode::DefGlobal, OpCode::DefGlobalLong);
+        currentChunk().writeIndexed(index, m_previous.line, OpCode::GetLocal, OpCode::GetLocalLong);
     }
 
-    void Compiler::emitGetGlobal(Value global)
+    void Compiler::emitSetLocal(size_t index)
     {
-        currentChunk().writeConstant(global, m_previous.line, OpCode::GetGlobal, OpCode::GetGlobalLong);
+        currentChunk().writeIndexed(index, m_previous.line, OpCode::SetLocal, OpCode::SetLocalLong);
     }
 
-    void Compiler::emitSetGlobal(Value global)
+    size_t Compiler::emitJump(OpCode opcodeLong)
     {
-        currentChunk().writeConstant(global, m_previous.line, OpCode::SetGlobal, OpCode::SetGlobalLong);
+        return currentChunk().writeJump(opcodeLong, m_previous.line);
     }
 
-    void Compiler::emitGetLocal(uint8_t index)
+    void Compiler::patchJump(size_t offset)
     {
-        emitByte(static_cast<uint8_t>(OpCode::GetLocal));
-        emitByte(index);
+        if (!currentChunk().patchJump(offset)) error("Too much code to jump over.");
     }
 
-    void Compiler::emitSetLocal(uint8_t index)
+    void Compiler::emitLoop(size_t loopStart, size_t loop)
     {
-        emitByte(static_cast<uint8_t>(OpCode::SetLocal));
-        emitByte(index);
+        if (!currentChunk().writeLoop(loopStart, loop, m_previous.line)) error("Loop body too large.");
     }
 
     void Compiler::errorAt(const Token &token, const char *message)
@@ -380,7 +684,7 @@ namespace Lux {
         { &variable, nullptr, Precedence::None },       // Identifier
         { &string,   nullptr, Precedence::None },       // String
         { &number,   nullptr, Precedence::None },       // Number
-        { nullptr,   nullptr, Precedence::None },       // And
+        { nullptr,   &logicalAnd, Precedence::And },    // And
         { nullptr,   nullptr, Precedence::None },       // Class
         { nullptr,   nullptr, Precedence::None },       // Else
         { &literal,  nullptr, Precedence::None },       // False
@@ -388,7 +692,7 @@ namespace Lux {
         { nullptr,   nullptr, Precedence::None },       // Fun
         { nullptr,   nullptr, Precedence::None },       // If
         { &literal,  nullptr, Precedence::None },       // Nil
-        { nullptr,   nullptr, Precedence::None },       // Or
+        { nullptr,   &logicalOr, Precedence::Or },      // Or
         { nullptr,   nullptr, Precedence::None },       // Print
         { nullptr,   nullptr, Precedence::None },       // Return
         { nullptr,   nullptr, Precedence::None },       // Super
@@ -1,18 +1,28 @@
 #pragma once
 #include "common.hpp"
+#include "chunk.hpp"
 #include "scanner.hpp"
+#include "types/hash_table.hpp"
 #include "types/value.hpp"
 
 #include <memory>
+#include <vector>
 
 namespace Lux {
 
-    class Chunk;
+    class Heap;
 
     class Compiler
     {
     public:
-        bool compile(const char *source, Chunk &chunk);
+        // Bump whenever the compiler or the optimizer emit different code for the same source,
+        // so that cached bytecode (see BytecodeCache) of older versions is never used.
+        static constexpr uint32_t CODEGEN_VERSION = 1;
+
+        bool compile(const char *source, Chunk &chunk, Heap &heap);
+        // Names and string literals are slices of source instead of copies. That only saves memory
+        // when the source is kept anyway, like a Program's.
+        bool compile(String* source, Chunk& chunk, Heap& heap);
     private:
         enum class Precedence {
             None,
@@ -28,6 +38,16 @@ namespace Lux {
             Primary
         };
 
+        // What is known at compile time about the last compiled expression.
+        struct ExpressionInfo {
+            size_t start = 0;                                   // offset of the first instruction of the expression
+            bool isConstant = false;                            // whole expression is one instruction pushing value
+            Value value = Value::makeNil();
+            Value::Type type = Value::Type::Undefined;          // type of the result if it's known, Undefined otherwise
+            Token::Type selfInverse = Token::Type::EndOfFile;   // Minus/Bang when the last instruction is that operator
+                                                                // applied to an operand it can be cancelled on
+        };
+
         struct ParseRule {
             using ParseFn = void(*)(Compiler &, bool);
 
@@ -36,7 +56,9 @@ namespace Lux {
             Precedence precedence;
         };
 
-        void reset(const char* source, Chunk& chunk);
+        void reset(const char* source, String* sourceString, Chunk& chunk, Heap& heap);
+        bool compileSource();
+        String* makeString(const char* start, size_t length);
         void advance();
         void consume(Token::Type type, const char* message);
         bool match(Token::Type type);
@@ -45,7 +67,12 @@ namespace Lux {
         void varDeclaration();
         void statement();
         void block();
+        void beginScope();
+        void endScope();
         void printStatement();
+        void ifStatement();
+        void whileStatement();
+        void forStatement();
         void expressionStatement();
 
         void expression();
@@ -57,15 +84,28 @@ namespace Lux {
         static void grouping(Compiler &c, bool canAssign);
         static void unary(Compiler &c, bool canAssign);
         static void binary(Compiler &c, bool canAssign);
+        static void logicalAnd(Compiler& c, bool canAssign);
+        static void logicalOr(Compiler& c, bool canAssign);
+
+        bool foldUnary(Token::Type operatorType, const ExpressionInfo& operand);
+        bool foldBinary(Token::Type operatorType, const ExpressionInfo& lhs, const ExpressionInfo& rhs);
+        bool evaluateUnary(Token::Type operatorType, Value operand, Value& result);
+        bool evaluateBinary(Token::Type operatorType, Value lhs, Value rhs, Value& result);
 
         Chunk& currentChunk() { return *m_currentChunk; }
         void emitByte(uint8_t byte);
         void emitConstant(Value constant);
-        void emitDefGlobal(Value global);
-        void emitGetGlobal(Value global);
-        void emitSetGlobal(Value global);
-        void emitGetLocal(uint8_t index);
-        void emitSetLocal(uint8_t index);
+        void emitValue(Value value);
+        void emitDefGlobal(String* name);
+        void emitGetGlobal(String* name);
+        void emitSetGlobal(String* name);
+        void emitGlobal(String* name, OpCode opcode, OpCode opcodeLong);
+        size_t resolveGlobal(String* name);
+        void emitGetLocal(size_t index);
+        void emitSetLocal(size_t index);
+        size_t emitJump(OpCode opcodeLong);
+        void patchJump(size_t offset);
+        void emitLoop(size_t loopStart, size_t loop);
 
         void errorAtCurrent(const char* message) { errorAt(m_current, message); }
         void error(const char* message) { errorAt(m_previous, message); }
@@ -74,19 +114,26 @@ namespace Lux {
 
         std::unique_ptr<Scanner> m_scanner{};
         Chunk *m_currentChunk = nullptr;
+        Heap *m_heap = nullptr;
+        const char* m_source = nullptr;
+        String* m_sourceString = nullptr; // Source as a heap string strings are sliced from, if it is one
         Token m_previous;
         Token m_current;
         bool m_hadError;
         bool m_panicMode;
+        ExpressionInfo m_expression;
 
         struct Local {
             Token name;
             int depth;
         };
 
+        static constexpr size_t MAX_LOCALS = Chunk::MAX_LONG_INDEX + 1;
+
         uint8_t m_scopeDepth;
-        uint8_t m_localCount;
-        Local m_locals[256];
+        std::vector<Local> m_locals;
+
+        HashTable m_globals; // name -> slot
 
         static ParseRule& getRule(Token::Type type);
         static ParseRule s_rules[];
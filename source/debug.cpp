@@ -1,5 +1,7 @@
 #include "debug.hpp"
 #include "chunk.hpp"
+#include "register_chunk.hpp"
+#include "types/string.hpp"
 
 namespace Lux {
 
@@ -9,6 +11,14 @@ namespace Lux {
         return offset + 1;
     }
 
+    static uint32_t readLong(const Chunk& chunk, size_t offset)
+    {
+        uint32_t index = chunk.getByte(offset);
+        index |= chunk.getByte(offset + 1) << 8;
+        index |= chunk.getByte(offset + 2) << 16;
+        return index;
+    }
+
     static size_t byteInstruction(const char* name, const Chunk& chunk, size_t offset)
     {
         uint8_t index = chunk.getByte(offset + 1);
@@ -16,6 +26,21 @@ namespace Lux {
         return offset + 2;
     }
 
+    static size_t bytePairInstruction(const char* name, const Chunk& chunk, size_t offset)
+    {
+        uint8_t first = chunk.getByte(offset + 1);
+        uint8_t second = chunk.getByte(offset + 2);
+        printf("%-16s %4d %4d\n", name, first, second);
+        return offset + 3;
+    }
+
+    static size_t longInstruction(const char* name, const Chunk& chunk, size_t offset)
+    {
+        uint32_t index = readLong(chunk, offset + 1);
+        printf("%-16s %4u\n", name, index);
+        return offset + 4;
+    }
+
 #define PRINT_CONSTANT() do { \
     std::printf("%-16s %4d  '", name, constant); \
     printValue(chunk.getConstant(constant)); \
@@ -31,15 +56,41 @@ namespace Lux {
 
     static size_t constantLongInstruction(const char* name, const Chunk& chunk, size_t offset)
     {
-        uint32_t constant = chunk.getByte(offset + 1);
-        constant |= chunk.getByte(offset + 2) << 8;
-        constant |= chunk.getByte(offset + 3) << 16;
+        uint32_t constant = readLong(chunk, offset + 1);
         PRINT_CONSTANT();
         return offset + 4;
     }
 
 #undef PRINT_CONSTANT
+
+    static size_t globalSlotInstruction(const char* name, const Chunk& chunk, size_t offset)
+    {
+        uint8_t slot = chunk.getByte(offset + 1);
+        const String* global = chunk.getGlobalNames()[slot];
+        std::printf("%-16s %4d  '%.*s'\n", name, slot, static_cast<int>(global->length()), global->data());
+        return offset + 2;
+    }
+
+    static size_t globalSlotLongInstruction(const char* name, const Chunk& chunk, size_t offset)
+    {
+        uint32_t slot = readLong(chunk, offset + 1);
+        const String* global = chunk.getGlobalNames()[slot];
+        std::printf("%-16s %4u  '%.*s'\n", name, slot, static_cast<int>(global->length()), global->data());
+        return offset + 4;
+    }
     
+    static size_t jumpInstruction(const char* name, const Chunk& chunk, size_t offset)
+    {
+        std::printf("%-16s %4zu -> %zu\n", name, offset, chunk.getJumpTarget(offset));
+        return offset + getInstructionSize(static_cast<OpCode>(chunk.getByte(offset)));
+    }
+
+    static size_t loopInstruction(const char* name, const Chunk& chunk, size_t offset)
+    {
+        std::printf("%-16s %4zu -> %zu  loop %u\n", name, offset, chunk.getJumpTarget(offset), chunk.getLoop(offset));
+        return offset + getInstructionSize(static_cast<OpCode>(chunk.getByte(offset)));
+    }
+
     void disassembleChunk(const Chunk& chunk, const char* name)
     {
         std::printf("== %s ==\n", name);
@@ -66,8 +117,16 @@ namespace Lux {
         case OpCode::GetGlobalLong: return constantLongInstruction("GET_GLOBAL_LONG", chunk, offset);
         case OpCode::SetGlobal: return constantInstruction("SET_GLOBAL", chunk, offset);
         case OpCode::SetGlobalLong: return constantLongInstruction("SET_GLOBAL_LONG", chunk, offset);
+        case OpCode::DefGlobalSlot: return globalSlotInstruction("DEF_GLOBAL_SLOT", chunk, offset);
+        case OpCode::DefGlobalSlotLong: return globalSlotLongInstruction("DEF_GLOBAL_SLOT_LONG", chunk, offset);
+        case OpCode::GetGlobalSlot: return globalSlotInstruction("GET_GLOBAL_SLOT", chunk, offset);
+        case OpCode::GetGlobalSlotLong: return globalSlotLongInstruction("GET_GLOBAL_SLOT_LONG", chunk, offset);
+        case OpCode::SetGlobalSlot: return globalSlotInstruction("SET_GLOBAL_SLOT", chunk, offset);
+        case OpCode::SetGlobalSlotLong: return globalSlotLongInstruction("SET_GLOBAL_SLOT_LONG", chunk, offset);
         case OpCode::GetLocal: return byteInstruction("GET_LOCAL", chunk, offset);
+        case OpCode::GetLocalLong: return longInstruction("GET_LOCAL_LONG", chunk, offset);
         case OpCode::SetLocal: return byteInstruction("SET_LOCAL", chunk, offset);
+        case OpCode::SetLocalLong: return longInstruction("SET_LOCAL_LONG", chunk, offset);
         case OpCode::Nil: return simpleInstruction("NIL", offset);
         case OpCode::True: return simpleInstruction("TRUE", offset);
         case OpCode::False: return simpleInstruction("FALSE", offset);
@@ -85,11 +144,100 @@ namespace Lux {
         case OpCode::GreaterEqual: return simpleInstruction("GREATER_EQUAL", offset);
         case OpCode::Print: return simpleInstruction("PRINT", offset);
         case OpCode::Pop: return simpleInstruction("POP", offset);
+        case OpCode::PopN: return byteInstruction("POP_N", chunk, offset);
+        case OpCode::Jump: return jumpInstruction("JUMP", chunk, offset);
+        case OpCode::JumpLong: return jumpInstruction("JUMP_LONG", chunk, offset);
+        case OpCode::JumpIfFalse: return jumpInstruction("JUMP_IF_FALSE", chunk, offset);
+        case OpCode::JumpIfFalseLong: return jumpInstruction("JUMP_IF_FALSE_LONG", chunk, offset);
+        case OpCode::JumpIfTrue: return jumpInstruction("JUMP_IF_TRUE", chunk, offset);
+        case OpCode::JumpIfTrueLong: return jumpInstruction("JUMP_IF_TRUE_LONG", chunk, offset);
+        case OpCode::Loop: return loopInstruction("LOOP", chunk, offset);
+        case OpCode::LoopLong: return loopInstruction("LOOP_LONG", chunk, offset);
         case OpCode::Return: return simpleInstruction("RETURN", offset);
+        case OpCode::GetLocalPair: return bytePairInstruction("GET_LOCAL_PAIR", chunk, offset);
+        case OpCode::AddLocals: return bytePairInstruction("ADD_LOCALS", chunk, offset);
+        case OpCode::AddConstant: return constantInstruction("ADD_CONSTANT", chunk, offset);
+        case OpCode::PrintGlobalSlot: return globalSlotInstruction("PRINT_GLOBAL_SLOT", chunk, offset);
+        case OpCode::NotLess: return simpleInstruction("NOT_LESS", offset);
+        case OpCode::AddNumber: return simpleInstruction("ADD_NUMBER", offset);
+        case OpCode::AddLocalsNumber: return bytePairInstruction("ADD_LOCALS_NUMBER", chunk, offset);
+        case OpCode::AddConstantNumber: return constantInstruction("ADD_CONSTANT_NUMBER", chunk, offset);
+        case OpCode::EqualNumber: return simpleInstruction("EQUAL_NUMBER", offset);
+        case OpCode::NotEqualNumber: return simpleInstruction("NOT_EQUAL_NUMBER", offset);
         default:
             std::printf("Unknown opcode %d\n", instruction);
             return offset + 1;
         }
     }
 
+    static void printRegisterOperand(const RegisterChunk& chunk, uint32_t operand)
+    {
+        if (operand & RegisterChunk::CONSTANT_BIT) {
+            uint32_t constant = operand & ~RegisterChunk::CONSTANT_BIT;
+            std::printf(" K%-4u '", constant);
+            printValue(chunk.getConstant(constant));
+            std::printf("'");
+        }
+        else
+            std::printf(" R%-4u", operand);
+    }
+
+    void disassembleRegisterChunk(const RegisterChunk& chunk, const char* name)
+    {
+        std::printf("== %s (%zu registers) ==\n", name, chunk.getRegisterCount());
+        std::printf("inst line opcode           operands\n");
+        for (size_t i = 0; i < chunk.getCodeSize(); i++) disassembleRegisterInstruction(chunk, i);
+    }
+
+    void disassembleRegisterInstruction(const RegisterChunk& chunk, size_t index)
+    {
+        std::printf("%04zu ", index);
+        if (index > 0 && chunk.getLine(index) == chunk.getLine(index - 1))
+            std::printf("   | ");
+        else
+            std::printf("%4zu ", chunk.getLine(index));
+
+        const RegisterInstruction& instruction = chunk.getInstruction(index);
+        std::printf("%-16s", getRegisterOpCodeName(instruction.opcode));
+        switch (instruction.opcode)
+        {
+        case RegisterOpCode::DefGlobal:
+        case RegisterOpCode::SetGlobal:
+            std::printf(" G%-4u", instruction.a);
+            printRegisterOperand(chunk, instruction.b);
+            break;
+        case RegisterOpCode::GetGlobal:
+            std::printf(" R%-4u G%-4u", instruction.a, instruction.b);
+            break;
+        case RegisterOpCode::Move:
+        case RegisterOpCode::Negate:
+        case RegisterOpCode::Not:
+            std::printf(" R%-4u", instruction.a);
+            printRegisterOperand(chunk, instruction.b);
+            break;
+        case RegisterOpCode::Print:
+            printRegisterOperand(chunk, instruction.a);
+            break;
+        case RegisterOpCode::Jump:
+            std::printf(" -> %u", instruction.a);
+            break;
+        case RegisterOpCode::JumpIfFalse:
+        case RegisterOpCode::JumpIfTrue:
+            std::printf(" -> %-4u", instruction.a);
+            printRegisterOperand(chunk, instruction.b);
+            break;
+        case RegisterOpCode::Loop:
+            std::printf(" -> %-4u loop %u", instruction.a, instruction.b);
+            break;
+        case RegisterOpCode::Return:
+            break;
+        default:
+            std::printf(" R%-4u", instruction.a);
+            printRegisterOperand(chunk, instruction.b);
+            printRegisterOperand(chunk, instruction.c);
+            break;
+        }
+        std::printf("\n");
+    }
+
 } // namespace Lux
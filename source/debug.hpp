@@ -1,10 +1,14 @@
 #pragma once
+#include "common.hpp"
 
 namespace Lux {
 
     class Chunk;
+    class RegisterChunk;
 
     void disassembleChunk(const Chunk& chunk, const char* name);
     size_t disassembleInstruction(const Chunk& chunk, size_t offset);
+    void disassembleRegisterChunk(const RegisterChunk& chunk, const char* name);
+    void disassembleRegisterInstruction(const RegisterChunk& chunk, size_t index);
 
 } // namespace Lux
@@ -0,0 +1,290 @@
+#include "heap.hpp"
+#include "types/rope.hpp"
+#include "types/string.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+namespace Lux {
+
+    Heap::Heap() :
+        Heap{ Config{} }
+    {}
+
+    Heap::Heap(Config config) :
+        m_config{ config },
+        m_nextMajorCollection{ config.initialThreshold }
+    {}
+
+    Heap::~Heap()
+    {
+        for (Object* list : { m_nursery, m_old }) {
+            while (list) {
+                Object* next = list->m_next;
+                destroyObject(list);
+                list = next;
+            }
+        }
+    }
+
+    String* Heap::makeString(const char* chars, size_t length)
+    {
+        uint32_t hash = hashString(chars, length);
+        String* interned = findString(chars, length, hash);
+        if (interned) return interned;
+
+        void* block = m_allocator.allocate(String::getAllocationSize(length));
+        char* buffer = static_cast<char*>(block) + sizeof(String);
+        std::memcpy(buffer, chars, length);
+        buffer[length] = '\0';
+        return intern(block, length, hash);
+    }
+
+    String* Heap::concatenate(const String& lhs, const String& rhs)
+    {
+        size_t length = lhs.length() + rhs.length();
+        void* block = m_allocator.allocate(String::getAllocationSize(length));
+        char* buffer = static_cast<char*>(block) + sizeof(String);
+        std::memcpy(buffer, lhs.data(), lhs.length());
+        std::memcpy(buffer + lhs.length(), rhs.data(), rhs.length());
+        buffer[length] = '\0';
+
+        uint32_t hash = hashString(buffer, length);
+        String* interned = findString(buffer, length, hash);
+        if (interned) {
+            m_allocator.free(block, String::getAllocationSize(length));
+            return interned;
+        }
+
+        return intern(block, length, hash);
+    }
+
+    String* Heap::makeSlice(String* parent, size_t start, size_t length)
+    {
+        const char* chars = parent->data() + start;
+        uint32_t hash = hashString(chars, length);
+        String* interned = findString(chars, length, hash);
+        if (interned) return interned;
+
+        // Slices of slices point to the string that owns the characters, so they never form chains.
+        if (parent->isSlice()) parent = parent->getParent();
+        String* slice = new (m_allocator.allocate(sizeof(String))) String(parent, chars, length, hash);
+        registerObject(slice, sizeof(String));
+        m_strings.insert(slice, Value::makeNil());
+        return slice;
+    }
+
+    String* Heap::copyString(const char* chars, size_t length)
+    {
+        String* string = allocateString(length);
+        std::memcpy(string->chars(), chars, length);
+        string->chars()[length] = '\0';
+        return string;
+    }
+
+    Object* Heap::concatenate(Object* lhs, Object* rhs)
+    {
+        size_t length = Rope::lengthOf(lhs) + Rope::lengthOf(rhs);
+        if (length < Rope::MIN_LENGTH) {
+            // Ropes are never shorter than MIN_LENGTH, so both sides are Strings here.
+            const String* lhsString = lhs->asString();
+            const String* rhsString = rhs->asString();
+            String* string = allocateString(length);
+            std::memcpy(string->chars(), lhsString->data(), lhsString->length());
+            std::memcpy(string->chars() + lhsString->length(), rhsString->data(), rhsString->length());
+            string->chars()[length] = '\0';
+            return string;
+        }
+        if (Rope::lengthOf(lhs) == 0) return rhs;
+        if (Rope::lengthOf(rhs) == 0) return lhs;
+
+        Rope* rope = new (m_allocator.allocate(sizeof(Rope))) Rope(lhs, rhs, length);
+        registerObject(rope, sizeof(Rope));
+        return rope;
+    }
+
+    String* Heap::flatten(Object* string)
+    {
+        if (string->isString()) return string->asString();
+
+        Rope* rope = string->asRope();
+        if (rope->m_flat) return rope->m_flat;
+
+        String* flat = allocateString(rope->length());
+        rope->copyTo(flat->chars());
+        flat->chars()[rope->length()] = '\0';
+
+        // The sides are not needed anymore, they can be collected if nothing else uses them.
+        rope->m_flat = flat;
+        rope->m_lhs = nullptr;
+        rope->m_rhs = nullptr;
+        if (rope->m_isOld)
+            m_rememberedRopes.push_back(rope);
+        return flat;
+    }
+
+    void Heap::freeze()
+    {
+        for (Object* list : { m_nursery, m_old })
+            for (Object* object = list; object; object = object->m_next)
+                object->m_isShared = true;
+    }
+
+    String* Heap::findString(const char* chars, size_t length, uint32_t hash) const
+    {
+        if (m_sharedStrings) {
+            String* shared = m_sharedStrings->findString(chars, length, hash);
+            if (shared) return shared;
+        }
+        return m_strings.findString(chars, length, hash);
+    }
+
+    String* Heap::intern(void* block, size_t length, uint32_t hash)
+    {
+        String* string = new (block) String(length, hash);
+        registerObject(string, String::getAllocationSize(length));
+        m_strings.insert(string, Value::makeNil());
+        return string;
+    }
+
+    String* Heap::allocateString(size_t length)
+    {
+        String* string = new (m_allocator.allocate(String::getAllocationSize(length))) String(length);
+        registerObject(string, String::getAllocationSize(length));
+        return string;
+    }
+
+    void Heap::beginCollection()
+    {
+        m_isMajorCollection = m_oldBytes > m_nextMajorCollection;
+        m_collectionCount++;
+    }
+
+    void Heap::markValue(Value value)
+    {
+        if (value.isObject()) markObject(value.asObject());
+    }
+
+    void Heap::markObject(Object* object)
+    {
+        if (object->m_isShared) return;
+        // Old objects survive minor collections anyway, leaving them unmarked saves clearing them later.
+        if (object->m_isOld && !m_isMajorCollection) return;
+        if (object->m_isMarked) return;
+        object->m_isMarked = true;
+        // Traced later, so deep ropes don't recurse.
+        if (object->isRope() || (object->isString() && object->asString()->isSlice()))
+            m_grayObjects.push_back(object);
+    }
+
+    void Heap::traceReferences()
+    {
+        if (!m_isMajorCollection)
+            for (Rope* rope : m_rememberedRopes)
+                markObject(rope->m_flat);
+        // Survivors of this collection are all old, so no old object points to a young one anymore.
+        m_rememberedRopes.clear();
+
+        while (!m_grayObjects.empty()) {
+            Object* object = m_grayObjects.back();
+            m_grayObjects.pop_back();
+            // Parents are always older than their slices, so slices need no barrier.
+            if (object->isString()) {
+                markObject(object->asString()->getParent());
+                continue;
+            }
+
+            Rope* rope = object->asRope();
+            if (rope->m_flat) markObject(rope->m_flat);
+            else {
+                markObject(rope->m_lhs);
+                markObject(rope->m_rhs);
+            }
+        }
+    }
+
+    void Heap::sweep()
+    {
+        traceReferences();
+
+        if (m_isMajorCollection) {
+            Object* survivors = nullptr;
+            m_oldBytes = 0;
+            for (Object* object = m_old; object;) {
+                Object* next = object->m_next;
+                if (object->m_isMarked) {
+                    object->m_isMarked = false;
+                    object->m_next = survivors;
+                    survivors = object;
+                    m_oldBytes += getObjectSize(object);
+                }
+                else freeObject(object);
+                object = next;
+            }
+            m_old = survivors;
+        }
+
+        // Nursery survivors are promoted to the old generation.
+        for (Object* object = m_nursery; object;) {
+            Object* next = object->m_next;
+            if (object->m_isMarked) {
+                object->m_isMarked = false;
+                object->m_isOld = true;
+                object->m_next = m_old;
+                m_old = object;
+                m_oldBytes += getObjectSize(object);
+            }
+            else freeObject(object);
+            object = next;
+        }
+        m_nursery = nullptr;
+        m_nurseryBytes = 0;
+
+        if (m_isMajorCollection) {
+            m_nextMajorCollection = std::max(m_config.initialThreshold, static_cast<size_t>(m_oldBytes * m_config.growthFactor));
+            m_isMajorCollection = false;
+        }
+    }
+
+    void Heap::registerObject(Object* object, size_t size)
+    {
+        object->m_next = m_nursery;
+        m_nursery = object;
+        m_nurseryBytes += size;
+    }
+
+    void Heap::freeObject(Object* object)
+    {
+        if (object->isString() && object->asString()->isInterned()) m_strings.remove(object->asString());
+        destroyObject(object);
+    }
+
+    void Heap::destroyObject(Object* object)
+    {
+        size_t size = getObjectSize(object);
+        switch (object->getType())
+        {
+        case Object::Type::String:
+            object->asString()->~String();
+            break;
+        case Object::Type::Rope:
+            object->asRope()->~Rope();
+            break;
+        }
+        m_allocator.free(object, size);
+    }
+
+    size_t Heap::getObjectSize(const Object* object)
+    {
+        switch (object->getType())
+        {
+        case Object::Type::String:
+            return object->asString()->getAllocationSize();
+        case Object::Type::Rope:
+            return sizeof(Rope);
+        }
+        return 0;
+    }
+
+} // namespace Lux
@@ -0,0 +1,103 @@
+#pragma once
+#include "common.hpp"
+#include "allocator.hpp"
+#include "types/hash_table.hpp"
+
+#include <vector>
+
+namespace Lux {
+
+    class Object;
+    class Rope;
+    class String;
+
+    // Creates the objects used by compiled and running code and reclaims them with a generational
+    // mark-and-sweep collector. Strings made by makeString go through the intern table, so two of
+    // them with equal contents are always the same object and can be compared by pointer. Strings
+    // made by concatenating objects at runtime skip the table and aren't hashed until it's needed.
+    //
+    // New objects start in the nursery. A minor collection frees unreachable nursery objects and
+    // promotes the survivors, a major collection sweeps every object. Only ropes and slices
+    // reference other objects, which are always older than them. The exception is a flattened rope,
+    // which gets a new string: an old rope flattened to a young string is remembered until the
+    // next collection so the string is marked through it.
+    //
+    // The Heap never decides to collect on its own: the owner checks needsCollection() at points
+    // where all live objects are reachable from its roots and then calls beginCollection(),
+    // marks the roots and calls sweep().
+    //
+    // A heap that won't allocate anymore can be frozen, its objects then live as long as the heap
+    // and other heaps can share its strings: they intern new strings to the shared ones when they
+    // are equal and never mark them, so a frozen heap can be read by several threads.
+    class Heap
+    {
+    public:
+        struct Config {
+            size_t nurserySize = 256 * 1024;          // bytes allocated in the nursery before a minor collection
+            size_t initialThreshold = 1024 * 1024;    // old generation size that triggers the first major collection
+            double growthFactor = 2.0;                // next major threshold = surviving bytes * growthFactor
+        };
+
+        Heap();
+        explicit Heap(Config config);
+        ~Heap();
+
+        String* makeString(const char* chars, size_t length);
+        // Like makeString, but if no equal string exists, the new one doesn't copy the characters
+        // from parent's range [start, start + length), it references them and keeps parent alive.
+        String* makeSlice(String* parent, size_t start, size_t length);
+        // String that is not interned.
+        String* copyString(const char* chars, size_t length);
+        String* concatenate(const String& lhs, const String& rhs);
+        // Strings or ropes, the result is a Rope unless it's shorter than Rope::MIN_LENGTH,
+        // then it's a String that is not interned.
+        Object* concatenate(Object* lhs, Object* rhs);
+        // String with the contents of a String or a Rope, ropes cache it. It's not interned.
+        String* flatten(Object* string);
+
+        void freeze();
+        // Strings of the frozen heap are used instead of creating equal ones, nullptr stops sharing.
+        void setSharedStrings(const Heap* heap) { m_sharedStrings = heap ? &heap->m_strings : nullptr; }
+
+        bool needsCollection() const { return m_nurseryBytes > m_config.nurserySize || m_oldBytes > m_nextMajorCollection; }
+        void beginCollection();
+        void markValue(Value value);
+        void markObject(Object* object);
+        void sweep();
+
+        size_t getBytesAllocated() const { return m_nurseryBytes + m_oldBytes; }
+        size_t getCollectionCount() const { return m_collectionCount; }
+
+        Heap(const Heap&) = delete;
+        Heap& operator=(const Heap&) = delete;
+    private:
+        String* findString(const char* chars, size_t length, uint32_t hash) const;
+        // Constructs a string in a block the caller already filled with characters.
+        String* intern(void* block, size_t length, uint32_t hash);
+        // Allocates a string that is not interned, the caller fills its characters.
+        String* allocateString(size_t length);
+        void registerObject(Object* object, size_t size);
+        void traceReferences();
+        void freeObject(Object* object);
+        // Runs the destructor of the object's actual type and frees its memory.
+        void destroyObject(Object* object);
+        static size_t getObjectSize(const Object* object);
+
+        Config m_config;
+        Allocator m_allocator;
+        HashTable m_strings; // Weak, dead strings are removed when they are swept.
+        const HashTable* m_sharedStrings = nullptr;
+
+        std::vector<Object*> m_grayObjects; // Marked objects whose references are not marked yet.
+        std::vector<Rope*> m_rememberedRopes;
+
+        Object* m_nursery = nullptr;
+        Object* m_old = nullptr;
+        size_t m_nurseryBytes = 0;
+        size_t m_oldBytes = 0;
+        size_t m_nextMajorCollection;
+        bool m_isMajorCollection = false;
+        size_t m_collectionCount = 0;
+    };
+
+} // namespace Lux
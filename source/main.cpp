@@ -1,35 +1,116 @@
 #include "vm.hpp"
+#include "batch_runner.hpp"
+#include "bytecode.hpp"
 #include "chunk.hpp"
 #include "debug.hpp"
+#include "mapped_file.hpp"
+#include "optimizer.hpp"
 
+#include <cstdlib>
 #include <fstream>
+#include <memory>
+#include <string>
 
-static bool readFile(const char* filename, char* data, size_t& size, bool binary = false)
+static bool writeFile(const char* filename, const std::vector<uint8_t>& data)
 {
-    std::ifstream fin(filename, binary ? std::ios::binary : std::ios::in);
-    if (!fin.is_open())
+    std::ofstream fout(filename, std::ios::binary);
+    if (!fout.is_open())
         return false;
 
-    bool retVal;
-    if (data) {
-        retVal = (bool)fin.read(data, size);
+    return (bool)fout.write(reinterpret_cast<const char*>(data.data()), data.size());
+}
+
+static std::shared_ptr<const Lux::Program> loadProgram(const char* path, int optimizationLevel)
+{
+    Lux::MappedFile file{ path };
+    if (!file.isOpen()) {
+        std::printf("Could not open file %s\n", path);
+        return nullptr;
     }
-    else {
-        fin.ignore(std::numeric_limits<std::streamsize>::max());
-        retVal = true;
+
+    if (Lux::Bytecode::isBytecode(file.getData(), file.getSize())) {
+        std::shared_ptr<const Lux::Program> program = Lux::Program::load(path);
+        if (!program)
+            std::printf("Invalid bytecode file %s\n", path);
+        return program;
     }
 
-    size = fin.gcount();
-    fin.close();
-    return retVal;
+    std::string source(reinterpret_cast<const char*>(file.getData()), file.getSize());
+    return Lux::Program::compile(source.c_str(), optimizationLevel);
+}
+
+// Runs every script count times on threadCount threads, outputs are printed in the order of the paths.
+static int runBatch(int pathCount, const char* paths[], size_t threadCount, size_t count,
+                    int optimizationLevel, Lux::Backend backend)
+{
+    // Everything is compiled up front, so no time is spent on scripts that would not run anyway.
+    std::vector<std::shared_ptr<const Lux::Program>> programs;
+    for (int i = 0; i < pathCount; i++) {
+        programs.push_back(loadProgram(paths[i], optimizationLevel));
+        if (!programs.back())
+            return static_cast<int>(Lux::InterpretResult::CompilationError);
+    }
+
+    Lux::BatchRunner runner{ threadCount, backend };
+    for (const auto& program : programs)
+        for (size_t i = 0; i < count; i++)
+            runner.submit(program);
+
+    Lux::InterpretResult result = Lux::InterpretResult::Success;
+    for (const Lux::BatchRunner::Result& job : runner.wait()) {
+        std::fwrite(job.output.data(), 1, job.output.size(), stdout);
+        if (job.result != Lux::InterpretResult::Success)
+            result = job.result;
+    }
+    return static_cast<int>(result);
 }
 
 int main(int argc, const char* argv[])
 {
     Lux::VM vm;
     Lux::InterpretResult result = Lux::InterpretResult::Success;
+    const char* output = nullptr;
+    int optimizationLevel = 0;
+    Lux::Backend backend = Lux::Backend::Stack;
+    bool batch = false;
+    size_t threadCount = 0;
+    size_t count = 1;
+
+    // Options come before the path.
+    while (argc > 1 && argv[1][0] == '-') {
+        if (argv[1][1] == 'O') {
+            optimizationLevel = argv[1][2] ? std::atoi(argv[1] + 2) : Lux::Optimizer::MAX_LEVEL;
+            vm.setOptimizationLevel(optimizationLevel);
+        }
+        else if (argv[1][1] == 'R' && !argv[1][2]) {
+            backend = Lux::Backend::Register;
+            vm.setBackend(backend);
+        }
+        else if (argv[1][1] == 'j') {
+            // Batch mode, any number of paths is accepted.
+            batch = true;
+            threadCount = std::strtoul(argv[1] + 2, nullptr, 10);
+        }
+        else if (argv[1][1] == 'n' && argv[1][2])
+            count = std::strtoul(argv[1] + 2, nullptr, 10);
+        else if (argv[1][1] == 'c' && !argv[1][2] && argc > 2) {
+            // Compile only, the bytecode can be run later by passing the output file instead of a script.
+            output = argv[2];
+            argv++;
+            argc--;
+        }
+        else {
+            std::printf("Unknown option %s\n", argv[1]);
+            return -1;
+        }
+        argv++;
+        argc--;
+    }
+
+    if (batch && argc > 1 && !output)
+        return runBatch(argc - 1, argv + 1, threadCount, count, optimizationLevel, backend);
 
-    if (argc == 1) {
+    if (argc == 1 && !output) {
         char line[1024];
         while(true) {
             std::printf("> ");
@@ -41,26 +122,45 @@ int main(int argc, const char* argv[])
         }
     }
     else if (argc == 2) {
-        size_t size;
-        if (!readFile(argv[1], nullptr, size)) {
+        Lux::MappedFile file{ argv[1] };
+        if (!file.isOpen()) {
             std::printf("Could not open file %s", argv[1]);
             return -1;
         }
 
-        char *source = new char[size + 1];
-        if (!readFile(argv[1], source, size)) {
-            std::printf("Could not read file %s", argv[1]);
-            delete[] source;
-            return -1;
+        if (Lux::Bytecode::isBytecode(file.getData(), file.getSize())) {
+            // Code is executed straight from the mapping.
+            Lux::Chunk chunk;
+            if (output || !Lux::Bytecode::deserialize(file.getData(), file.getSize(), chunk, vm.getHeap())) {
+                std::printf("Invalid bytecode file %s", argv[1]);
+                return -1;
+            }
+            result = vm.interpret(chunk);
         }
-        source[size] = '\0';
-
-        result = vm.interpret(source);
-
-        delete[] source;
+        else {
+            std::string source(reinterpret_cast<const char*>(file.getData()), file.getSize());
+            if (output) {
+                Lux::Chunk chunk;
+                if (!vm.compile(source.c_str(), chunk))
+                    return static_cast<int>(Lux::InterpretResult::CompilationError);
+                if (!writeFile(output, Lux::Bytecode::serialize(chunk))) {
+                    std::printf("Could not write file %s", output);
+                    return -1;
+                }
+            }
+            else {
+                // Scripts run by path are compiled once and then loaded from the cache while they don't change.
+                vm.setCacheDirectory(std::getenv("LUX_CACHE_DIR"));
+                result = vm.interpret(source.c_str());
+            }
+        }
+#ifdef LUX_PROFILE_OPCODES
+        vm.printOpcodeProfile(stderr);
+#endif
     }
     else {
-        std::printf("Usage: lux [path]\n");
+        std::printf("Usage: lux [-O<level>] [-R] [-c <output>] [path]\n"
+                    "       lux -j[<threads>] [-n<count>] [-O<level>] [-R] path...\n");
     }
 
     return static_cast<int>(result);
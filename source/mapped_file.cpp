@@ -0,0 +1,59 @@
+#include "mapped_file.hpp"
+
+#ifdef _WIN32
+#include <fstream>
+#include <iterator>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Lux {
+
+#ifdef _WIN32
+    MappedFile::MappedFile(const char* path)
+    {
+        std::ifstream fin(path, std::ios::binary);
+        if (!fin.is_open()) return;
+
+        m_buffer.assign(std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>());
+        m_data = m_buffer.data();
+        m_size = m_buffer.size();
+        m_isOpen = true;
+    }
+
+    MappedFile::~MappedFile() = default;
+#else
+    MappedFile::MappedFile(const char* path)
+    {
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) return;
+
+        struct stat info;
+        if (::fstat(fd, &info) == 0 && S_ISREG(info.st_mode)) {
+            m_size = static_cast<size_t>(info.st_size);
+            // Empty files can't be mapped, there's nothing to read from them anyway.
+            if (m_size == 0)
+                m_isOpen = true;
+            else {
+                void* data = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (data != MAP_FAILED) {
+                    m_data = static_cast<const uint8_t*>(data);
+                    m_isOpen = true;
+                }
+            }
+        }
+
+        // The mapping stays valid after the descriptor is closed.
+        ::close(fd);
+    }
+
+    MappedFile::~MappedFile()
+    {
+        if (m_data) ::munmap(const_cast<uint8_t*>(m_data), m_size);
+    }
+#endif
+
+} // namespace Lux
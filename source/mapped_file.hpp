@@ -0,0 +1,33 @@
+#pragma once
+#include "common.hpp"
+
+#ifdef _WIN32
+#include <vector>
+#endif
+
+namespace Lux {
+
+    // Read-only view of a whole file. Where the platform supports it the file is memory-mapped,
+    // so it is paged in only as it's used and never copied, otherwise it's read into a buffer.
+    class MappedFile
+    {
+    public:
+        explicit MappedFile(const char* path);
+        ~MappedFile();
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        bool isOpen() const { return m_isOpen; }
+        const uint8_t* getData() const { return m_data; }
+        size_t getSize() const { return m_size; }
+    private:
+        const uint8_t* m_data = nullptr;
+        size_t m_size = 0;
+        bool m_isOpen = false;
+#ifdef _WIN32
+        std::vector<uint8_t> m_buffer;
+#endif
+    };
+
+} // namespace Lux
@@ -0,0 +1,318 @@
+#include "optimizer.hpp"
+
+#include <algorithm>
+#include <bit>
+
+namespace Lux {
+
+    void Optimizer::optimize(Chunk& chunk, int level)
+    {
+        if (level < 1) return;
+
+        std::vector<Instruction> instructions = rewrite(decode(chunk), &peepholeTail);
+        removeDeadConstants(chunk, instructions);
+        if (level >= 2) instructions = rewrite(instructions, &fuseTail);
+        encode(chunk, instructions);
+    }
+
+    std::vector<Optimizer::Instruction> Optimizer::decode(const Chunk& chunk)
+    {
+        std::vector<Instruction> instructions;
+        std::vector<size_t> offsets;
+        for (size_t offset = 0; offset < chunk.getCodeSize();)
+        {
+            OpCode opcode = static_cast<OpCode>(chunk.getByte(offset));
+            size_t size = getInstructionSize(opcode);
+
+            uint32_t operand = 0;
+            size_t target = 0;
+            if (isJump(opcode)) {
+                // Targets are byte offsets until every instruction is decoded.
+                target = chunk.getJumpTarget(offset);
+                if (opcode == OpCode::Loop || opcode == OpCode::LoopLong) operand = chunk.getLoop(offset);
+            }
+            else {
+                for (size_t i = 1; i < size; i++)
+                    operand |= chunk.getByte(offset + i) << (8 * (i - 1));
+            }
+
+            instructions.emplace_back(getShortForm(opcode), operand, chunk.getLine(offset), target);
+            offsets.emplace_back(offset);
+            offset += size;
+        }
+
+        for (Instruction& instruction : instructions) {
+            if (!isJump(instruction.opcode)) continue;
+
+            instruction.target = std::lower_bound(offsets.begin(), offsets.end(), instruction.target) - offsets.begin();
+            instructions[instruction.target].isJumpTarget = true;
+        }
+        return instructions;
+    }
+
+    void Optimizer::encode(Chunk& chunk, const std::vector<Instruction>& instructions)
+    {
+        // Jumps start out short and the ones whose distance doesn't fit are made long until none has to be.
+        // Making a jump long only makes other distances longer, so a jump never has to become short again.
+        std::vector<size_t> offsets(instructions.size() + 1);
+        std::vector<bool> isLongJump(instructions.size());
+        auto getDistance = [&](size_t i) {
+            const Instruction& instruction = instructions[i];
+            return instruction.opcode == OpCode::Loop ?
+                offsets[i + 1] - offsets[instruction.target] : offsets[instruction.target] - offsets[i + 1];
+        };
+        for (bool hasChanged = true; hasChanged;) {
+            hasChanged = false;
+            for (size_t i = 0; i < instructions.size(); i++)
+                offsets[i + 1] = offsets[i] + getEncodedSize(instructions[i], isLongJump[i]);
+
+            for (size_t i = 0; i < instructions.size(); i++) {
+                if (!isJump(instructions[i].opcode) || isLongJump[i]) continue;
+                if (getDistance(i) > UINT8_MAX || instructions[i].operand > UINT8_MAX) {
+                    isLongJump[i] = true;
+                    hasChanged = true;
+                }
+            }
+        }
+
+        // Optimized code is always owned by the chunk, even if it was executing external code before.
+        chunk.m_externalCode = nullptr;
+        chunk.m_externalCodeSize = 0;
+        chunk.m_code.clear();
+        chunk.m_lines.clear();
+        for (size_t i = 0; i < instructions.size(); i++)
+        {
+            Instruction instruction = instructions[i];
+            if (instruction.opcode == OpCode::Loop) {
+                chunk.writeLoop(offsets[instruction.target], instruction.operand, instruction.line);
+                continue;
+            }
+            if (isJump(instruction.opcode)) instruction.operand = static_cast<uint32_t>(getDistance(i));
+
+            OpCode longForm = getLongForm(instruction.opcode);
+            if (longForm != instruction.opcode)
+                chunk.writeIndexed(instruction.operand, instruction.line, instruction.opcode, longForm);
+            else {
+                chunk.write(static_cast<uint8_t>(instruction.opcode), instruction.line);
+                for (size_t byte = 1; byte < getInstructionSize(instruction.opcode); byte++)
+                    chunk.write(static_cast<uint8_t>(instruction.operand >> (8 * (byte - 1))), instruction.line);
+            }
+        }
+        // Folding can lower the maximum depth, and the instruction reaching it moves anyway.
+        chunk.computeMaxStackDepth();
+    }
+
+    size_t Optimizer::getEncodedSize(const Instruction& instruction, bool isLongJump)
+    {
+        OpCode longForm = getLongForm(instruction.opcode);
+        if (isJump(instruction.opcode))
+            return getInstructionSize(isLongJump ? longForm : instruction.opcode);
+        if (longForm != instruction.opcode && instruction.operand > UINT8_MAX)
+            return getInstructionSize(longForm);
+        return getInstructionSize(instruction.opcode);
+    }
+
+    std::vector<Optimizer::Instruction> Optimizer::rewrite(const std::vector<Instruction>& instructions, RewriteTail rewriteTail)
+    {
+        // Rewriting the tail after every appended instruction lets one rewrite enable the next one.
+        // Rewrites never remove a jump target or merge it into the instruction before it, so a target
+        // stays at the index it was appended at, jumps get their new targets once everything is rewritten.
+        std::vector<Instruction> result;
+        std::vector<size_t> indices(instructions.size());
+        result.reserve(instructions.size());
+        for (size_t i = 0; i < instructions.size(); i++) {
+            indices[i] = result.size();
+            result.emplace_back(instructions[i]);
+            while (rewriteTail(result));
+        }
+
+        for (Instruction& instruction : result)
+            if (isJump(instruction.opcode)) instruction.target = indices[instruction.target];
+        return result;
+    }
+
+    bool Optimizer::peepholeTail(std::vector<Instruction>& instructions)
+    {
+        size_t size = instructions.size();
+        if (size < 2) return false;
+
+        Instruction& last = instructions[size - 1];
+        Instruction& previous = instructions[size - 2];
+        // Code jumping to last doesn't run previous.
+        if (last.isJumpTarget) return false;
+
+        if (last.opcode == OpCode::Not) {
+            if (previous.opcode == OpCode::Equal || previous.opcode == OpCode::NotEqual) {
+                previous.opcode = previous.opcode == OpCode::Equal ? OpCode::NotEqual : OpCode::Equal;
+                instructions.pop_back();
+                return true;
+            }
+        }
+        else if (last.opcode == OpCode::Pop) {
+            switch (previous.opcode)
+            {
+            case OpCode::Constant:
+            case OpCode::Nil:
+            case OpCode::True:
+            case OpCode::False:
+            case OpCode::GetLocal:
+                if (previous.isJumpTarget) return false;
+                instructions.resize(size - 2);
+                return true;
+            case OpCode::Pop:
+                previous.opcode = OpCode::PopN;
+                previous.operand = 2;
+                instructions.pop_back();
+                return true;
+            case OpCode::PopN:
+                if (previous.operand == UINT8_MAX) return false;
+                previous.operand++;
+                instructions.pop_back();
+                return true;
+            default:
+                break;
+            }
+        }
+        else if (size >= 3 && previous.opcode == OpCode::Pop && !previous.isJumpTarget) {
+            // Set leaves the stored value on the stack, so it doesn't have to be popped and loaded again.
+            // GetGlobalSlot can't fail here since SetGlobalSlot would have failed first.
+            const Instruction& store = instructions[size - 3];
+            if (((store.opcode == OpCode::SetLocal && last.opcode == OpCode::GetLocal) ||
+                 (store.opcode == OpCode::SetGlobalSlot && last.opcode == OpCode::GetGlobalSlot)) &&
+                store.operand == last.operand) {
+                instructions.resize(size - 2);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    bool Optimizer::fuseTail(std::vector<Instruction>& instructions)
+    {
+        size_t size = instructions.size();
+        if (size < 2) return false;
+
+        Instruction& last = instructions[size - 1];
+        Instruction& previous = instructions[size - 2];
+        if (last.line != previous.line || last.isJumpTarget) return false;
+
+        // Superinstructions only have byte operands.
+        bool isByte = previous.operand <= UINT8_MAX;
+        OpCode fused = OpCode::Count;
+        uint32_t operand = previous.operand;
+        switch (last.opcode)
+        {
+        case OpCode::GetLocal:
+            if (previous.opcode == OpCode::GetLocal && isByte && last.operand <= UINT8_MAX) {
+                fused = OpCode::GetLocalPair;
+                operand = previous.operand | (last.operand << 8);
+            }
+            break;
+        case OpCode::Add:
+            if (previous.opcode == OpCode::GetLocalPair) fused = OpCode::AddLocals;
+            else if (previous.opcode == OpCode::Constant && isByte) fused = OpCode::AddConstant;
+            break;
+        case OpCode::Print:
+            if (previous.opcode == OpCode::GetGlobalSlot && isByte) fused = OpCode::PrintGlobalSlot;
+            break;
+        case OpCode::Not:
+            if (previous.opcode == OpCode::Less) fused = OpCode::NotLess;
+            break;
+        default:
+            break;
+        }
+        if (fused == OpCode::Count) return false;
+
+        previous.opcode = fused;
+        previous.operand = operand;
+        instructions.pop_back();
+        return true;
+    }
+
+    void Optimizer::removeDeadConstants(Chunk& chunk, std::vector<Instruction>& instructions)
+    {
+        constexpr uint32_t UNUSED = UINT32_MAX;
+        std::vector<uint32_t> remap(chunk.m_constants.size(), UNUSED);
+        std::vector<Value> constants;
+        for (Instruction& instruction : instructions) {
+            if (!usesConstant(instruction.opcode)) continue;
+
+            uint32_t& index = remap[instruction.operand];
+            if (index == UNUSED) {
+                index = static_cast<uint32_t>(constants.size());
+                constants.emplace_back(chunk.m_constants[instruction.operand]);
+            }
+            instruction.operand = index;
+        }
+
+        chunk.m_constants = std::move(constants);
+        chunk.m_numberConstants.clear();
+        chunk.m_objectConstants.clear();
+        for (size_t i = 0; i < chunk.m_constants.size(); i++) {
+            Value constant = chunk.m_constants[i];
+            if (constant.isNumber())
+                chunk.m_numberConstants.emplace(std::bit_cast<uint64_t>(constant.asNumber()), i);
+            else if (constant.isObject())
+                chunk.m_objectConstants.emplace(constant.asObject(), i);
+        }
+    }
+
+    OpCode Optimizer::getShortForm(OpCode opcode)
+    {
+        switch (opcode)
+        {
+        case OpCode::ConstantLong:      return OpCode::Constant;
+        case OpCode::DefGlobalLong:     return OpCode::DefGlobal;
+        case OpCode::GetGlobalLong:     return OpCode::GetGlobal;
+        case OpCode::SetGlobalLong:     return OpCode::SetGlobal;
+        case OpCode::DefGlobalSlotLong: return OpCode::DefGlobalSlot;
+        case OpCode::GetGlobalSlotLong: return OpCode::GetGlobalSlot;
+        case OpCode::SetGlobalSlotLong: return OpCode::SetGlobalSlot;
+        case OpCode::GetLocalLong:      return OpCode::GetLocal;
+        case OpCode::SetLocalLong:      return OpCode::SetLocal;
+        case OpCode::JumpLong:          return OpCode::Jump;
+        case OpCode::JumpIfFalseLong:   return OpCode::JumpIfFalse;
+        case OpCode::JumpIfTrueLong:    return OpCode::JumpIfTrue;
+        case OpCode::LoopLong:          return OpCode::Loop;
+        default:                        return opcode;
+        }
+    }
+
+    OpCode Optimizer::getLongForm(OpCode opcode)
+    {
+        switch (opcode)
+        {
+        case OpCode::Constant:      return OpCode::ConstantLong;
+        case OpCode::DefGlobal:     return OpCode::DefGlobalLong;
+        case OpCode::GetGlobal:     return OpCode::GetGlobalLong;
+        case OpCode::SetGlobal:     return OpCode::SetGlobalLong;
+        case OpCode::DefGlobalSlot: return OpCode::DefGlobalSlotLong;
+        case OpCode::GetGlobalSlot: return OpCode::GetGlobalSlotLong;
+        case OpCode::SetGlobalSlot: return OpCode::SetGlobalSlotLong;
+        case OpCode::GetLocal:      return OpCode::GetLocalLong;
+        case OpCode::SetLocal:      return OpCode::SetLocalLong;
+        case OpCode::Jump:          return OpCode::JumpLong;
+        case OpCode::JumpIfFalse:   return OpCode::JumpIfFalseLong;
+        case OpCode::JumpIfTrue:    return OpCode::JumpIfTrueLong;
+        case OpCode::Loop:          return OpCode::LoopLong;
+        default:                    return opcode;
+        }
+    }
+
+    bool Optimizer::usesConstant(OpCode opcode)
+    {
+        switch (opcode)
+        {
+        case OpCode::Constant:
+        case OpCode::DefGlobal:
+        case OpCode::GetGlobal:
+        case OpCode::SetGlobal:
+        case OpCode::AddConstant:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+} // namespace Lux
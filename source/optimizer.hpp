@@ -0,0 +1,54 @@
+#pragma once
+#include "common.hpp"
+#include "chunk.hpp"
+
+#include <vector>
+
+namespace Lux {
+
+    // Rewrites the bytecode of a finished chunk into an equivalent one that dispatches fewer instructions.
+    // Level 0 leaves the chunk untouched, level 1 runs peephole rewrites:
+    //  - runs of Pop become a single PopN,
+    //  - Equal/NotEqual followed by Not become the opposite comparison,
+    //  - a store to a variable followed by Pop and a load of the same variable keeps the stored value instead,
+    //  - values that are pushed without side effects and immediately popped are not pushed at all,
+    // and then drops constants that are no longer referenced.
+    // Level 2 additionally fuses frequent sequences into the superinstructions declared after Return in LUX_OPCODES.
+    // The sequences were picked from VM opcode pair counts (see VM::printOpcodeProfile), only instructions
+    // on the same line are fused so that runtime errors keep reporting the right line.
+    // Neither level rewrites a sequence across an instruction that is jumped to, jumps are re-encoded in their
+    // short form wherever their distance fits.
+    class Optimizer
+    {
+    public:
+        static constexpr int MAX_LEVEL = 2;
+
+        static void optimize(Chunk& chunk, int level);
+    private:
+        // Long opcodes are decoded to their short form with the full operand, encoding picks the form again.
+        // Instructions with several operand bytes keep them little-endian in operand.
+        // Jumps keep the index of the instruction they jump to instead of their distance, Loop keeps its loop in operand.
+        struct Instruction {
+            OpCode opcode;
+            uint32_t operand;
+            size_t line;
+            size_t target = 0;
+            bool isJumpTarget = false;
+        };
+        using RewriteTail = bool(*)(std::vector<Instruction>&);
+
+        static std::vector<Instruction> decode(const Chunk& chunk);
+        static void encode(Chunk& chunk, const std::vector<Instruction>& instructions);
+        static size_t getEncodedSize(const Instruction& instruction, bool isLongJump);
+
+        static std::vector<Instruction> rewrite(const std::vector<Instruction>& instructions, RewriteTail rewriteTail);
+        static bool peepholeTail(std::vector<Instruction>& instructions);
+        static bool fuseTail(std::vector<Instruction>& instructions);
+        static void removeDeadConstants(Chunk& chunk, std::vector<Instruction>& instructions);
+
+        static OpCode getShortForm(OpCode opcode);
+        static OpCode getLongForm(OpCode opcode);
+        static bool usesConstant(OpCode opcode);
+    };
+
+} // namespace Lux
@@ -0,0 +1,49 @@
+#include "program.hpp"
+#include "bytecode.hpp"
+#include "compiler.hpp"
+#include "optimizer.hpp"
+#include "register_generator.hpp"
+
+#include <atomic>
+#include <cstring>
+
+namespace Lux {
+
+    Program::Program()
+    {
+        static std::atomic<uint64_t> s_nextId = 1;
+        m_id = s_nextId++;
+    }
+
+    void Program::finish()
+    {
+        // Register code is generated up front too, so runs on either backend don't redo any work.
+        m_hasRegisterCode = RegisterGenerator::generate(m_chunk, m_registerChunk);
+        m_heap.freeze();
+    }
+
+    std::unique_ptr<Program> Program::compile(const char* source, int optimizationLevel)
+    {
+        std::unique_ptr<Program> program{ new Program };
+        program->m_source = program->m_heap.copyString(source, std::strlen(source));
+        Compiler compiler;
+        if (!compiler.compile(program->m_source, program->m_chunk, program->m_heap)) return nullptr;
+        Optimizer::optimize(program->m_chunk, optimizationLevel);
+
+        program->finish();
+        return program;
+    }
+
+    std::unique_ptr<Program> Program::load(const char* path)
+    {
+        std::unique_ptr<Program> program{ new Program };
+        program->m_file = std::make_unique<MappedFile>(path);
+        const MappedFile& file = *program->m_file;
+        if (!file.isOpen() || !Bytecode::deserialize(file.getData(), file.getSize(), program->m_chunk, program->m_heap))
+            return nullptr;
+
+        program->finish();
+        return program;
+    }
+
+} // namespace Lux
@@ -0,0 +1,48 @@
+#pragma once
+#include "common.hpp"
+#include "chunk.hpp"
+#include "heap.hpp"
+#include "mapped_file.hpp"
+#include "register_chunk.hpp"
+
+#include <memory>
+
+namespace Lux {
+
+    // Compiled script that can be run any number of times, by any number of VMs (see VM::run).
+    // It owns its code and a frozen heap with its string constants, and it never changes after
+    // it's created, so it can be shared between threads.
+    class Program
+    {
+    public:
+        // Returns nullptr if the source doesn't compile, errors are reported like by VM::interpret.
+        static std::unique_ptr<Program> compile(const char* source, int optimizationLevel = 0);
+        // Loads a bytecode file (see Bytecode), its code is executed straight from the mapped file.
+        static std::unique_ptr<Program> load(const char* path);
+
+        const Chunk& getChunk() const { return m_chunk; }
+        // nullptr if the program can't run on the register VM.
+        const RegisterChunk* getRegisterChunk() const { return m_hasRegisterCode ? &m_registerChunk : nullptr; }
+        const Heap& getHeap() const { return m_heap; }
+        // Text the program was compiled from, its names and string literals are slices of it.
+        // nullptr if the program was loaded.
+        const String* getSource() const { return m_source; }
+        // Unique for the life of the process, unlike the program's address.
+        uint64_t getId() const { return m_id; }
+
+        Program(const Program&) = delete;
+        Program& operator=(const Program&) = delete;
+    private:
+        Program();
+        void finish();
+
+        uint64_t m_id;
+        Heap m_heap;
+        String* m_source = nullptr;
+        std::unique_ptr<MappedFile> m_file;
+        Chunk m_chunk;
+        RegisterChunk m_registerChunk;
+        bool m_hasRegisterCode = false;
+    };
+
+} // namespace Lux
@@ -0,0 +1,43 @@
+#include "register_chunk.hpp"
+#include "chunk.hpp"
+
+#include <algorithm>
+#include <iterator>
+
+namespace Lux {
+
+    const char* getRegisterOpCodeName(RegisterOpCode opcode)
+    {
+        static constexpr const char* s_names[] = {
+#define LUX_REGISTER_OPCODE_NAME(name) #name,
+            LUX_REGISTER_OPCODES(LUX_REGISTER_OPCODE_NAME)
+#undef LUX_REGISTER_OPCODE_NAME
+        };
+        return s_names[static_cast<size_t>(opcode)];
+    }
+
+    void RegisterChunk::write(RegisterInstruction instruction, size_t line)
+    {
+        m_code.emplace_back(instruction);
+        m_lines.emplace_back(line);
+    }
+
+    void RegisterChunk::setConstants(const Chunk& chunk)
+    {
+        m_constants.clear();
+        for (size_t i = 0; i < chunk.getConstantCount(); i++)
+            m_constants.emplace_back(chunk.getConstant(i));
+        std::fill(std::begin(m_literals), std::end(m_literals), 0);
+    }
+
+    uint32_t RegisterChunk::addLiteral(Value value)
+    {
+        uint32_t& literal = m_literals[value.isNil() ? 0 : 1 + value.asBool()];
+        if (literal == 0) {
+            literal = static_cast<uint32_t>(m_constants.size()) | CONSTANT_BIT;
+            m_constants.emplace_back(value);
+        }
+        return literal;
+    }
+
+} // namespace Lux
@@ -0,0 +1,88 @@
+#pragma once
+#include "types/value.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace Lux {
+
+    class Chunk;
+
+// X(name), operands of each instruction are in its comment. R[x] is a register (stack slot), globals are
+// addressed by slot and RK(x) is either a register or a constant (see RegisterChunk::CONSTANT_BIT).
+// Jump targets are instruction indices.
+#define LUX_REGISTER_OPCODES(X)                       \
+    X(Move)         /* R[A] = RK(B)                 */ \
+    X(DefGlobal)    /* globals[A] = RK(B)           */ \
+    X(GetGlobal)    /* R[A] = globals[B]            */ \
+    X(SetGlobal)    /* globals[A] = RK(B)           */ \
+    X(Negate)       /* R[A] = -RK(B)                */ \
+    X(Not)          /* R[A] = !RK(B)                */ \
+    X(Add)          /* R[A] = RK(B) + RK(C)         */ \
+    X(Subtract)     /* R[A] = RK(B) - RK(C)         */ \
+    X(Multiply)     /* R[A] = RK(B) * RK(C)         */ \
+    X(Divide)       /* R[A] = RK(B) / RK(C)         */ \
+    X(Equal)        /* R[A] = RK(B) == RK(C)        */ \
+    X(NotEqual)     /* R[A] = RK(B) != RK(C)        */ \
+    X(Less)         /* R[A] = RK(B) < RK(C)         */ \
+    X(LessEqual)    /* R[A] = RK(B) <= RK(C)        */ \
+    X(Greater)      /* R[A] = RK(B) > RK(C)         */ \
+    X(GreaterEqual) /* R[A] = RK(B) >= RK(C)        */ \
+    X(Print)        /* print RK(A)                  */ \
+    X(Jump)         /* goto A                       */ \
+    X(JumpIfFalse)  /* if (!RK(B)) goto A           */ \
+    X(JumpIfTrue)   /* if (RK(B)) goto A            */ \
+    X(Loop)         /* backedges[B]++; goto A       */ \
+    X(Return)       /*                              */
+
+    enum class RegisterOpCode : uint8_t {
+#define LUX_REGISTER_OPCODE_ENUM(name) name,
+        LUX_REGISTER_OPCODES(LUX_REGISTER_OPCODE_ENUM)
+#undef LUX_REGISTER_OPCODE_ENUM
+        Count
+    };
+
+    const char* getRegisterOpCodeName(RegisterOpCode opcode);
+
+    // Three-address instructions: fixed size, so that operands don't have to be decoded byte by byte.
+    struct RegisterInstruction {
+        RegisterOpCode opcode;
+        uint32_t a;
+        uint32_t b;
+        uint32_t c;
+    };
+
+    // Code for the register VM. Registers are the VM stack slots, so locals keep the slots
+    // the compiler gave them and temporaries use the slots they would occupy on the stack.
+    class RegisterChunk
+    {
+    public:
+        // Set in RK operands that refer to a constant.
+        static constexpr uint32_t CONSTANT_BIT = 1u << 31;
+
+        void write(RegisterInstruction instruction, size_t line);
+
+        const RegisterInstruction* getCode() const { return m_code.data(); }
+        size_t getCodeSize() const { return m_code.size(); }
+        const RegisterInstruction& getInstruction(size_t index) const { return m_code[index]; }
+        RegisterInstruction& getInstruction(size_t index) { return m_code[index]; }
+        size_t getLine(size_t index) const { return m_lines[index]; }
+
+        // Constants of the stack chunk keep their indices, nil and bools are appended when needed.
+        void setConstants(const Chunk& chunk);
+        // Returns RK operand of a nil or bool constant.
+        uint32_t addLiteral(Value value);
+        const Value* getConstants() const { return m_constants.data(); }
+        Value getConstant(size_t index) const { return m_constants[index]; }
+
+        size_t getRegisterCount() const { return m_registerCount; }
+        void setRegisterCount(size_t count) { m_registerCount = count; }
+    private:
+        std::vector<RegisterInstruction> m_code;
+        std::vector<size_t> m_lines; // line of each instruction
+        std::vector<Value> m_constants;
+        uint32_t m_literals[3] = {}; // RK operands of nil, false and true, 0 if not added yet
+        size_t m_registerCount = 0;
+    };
+
+} // namespace Lux
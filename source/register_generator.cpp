@@ -0,0 +1,302 @@
+#include "register_generator.hpp"
+
+#include <algorithm>
+
+#ifdef DEBUG_PRINT_CODE
+#include "debug.hpp"
+#endif
+
+namespace Lux {
+
+    bool RegisterGenerator::generate(const Chunk& chunk, RegisterChunk& registerChunk)
+    {
+        registerChunk = {};
+        registerChunk.setConstants(chunk);
+
+        RegisterGenerator generator{ registerChunk };
+        for (size_t offset = 0; offset < chunk.getCodeSize();) {
+            OpCode opcode = static_cast<OpCode>(chunk.getByte(offset));
+            if (isJump(opcode)) generator.m_labels.try_emplace(chunk.getJumpTarget(offset));
+            offset += getInstructionSize(opcode);
+        }
+
+        for (size_t offset = 0; offset < chunk.getCodeSize();)
+        {
+            OpCode opcode = static_cast<OpCode>(chunk.getByte(offset));
+            size_t size = getInstructionSize(opcode);
+
+            if (auto label = generator.m_labels.find(offset); label != generator.m_labels.end()) {
+                if (!generator.bindLabel(label->second)) return false;
+            }
+            // Code only reachable by jumps has to start at a label.
+            else if (!generator.m_isReachable) return false;
+
+            if (isJump(opcode)) {
+                if (!generator.jump(opcode, chunk.getJumpTarget(offset), chunk.getLoop(offset), chunk.getLine(offset)))
+                    return false;
+                offset += size;
+                continue;
+            }
+
+            uint32_t operand = 0;
+            for (size_t i = 1; i < size; i++)
+                operand |= chunk.getByte(offset + i) << (8 * (i - 1));
+
+            if (!generator.translate(opcode, operand, chunk.getLine(offset))) return false;
+            offset += size;
+        }
+        registerChunk.setRegisterCount(generator.m_registerCount);
+
+#ifdef DEBUG_PRINT_CODE
+        disassembleRegisterChunk(registerChunk, "registers");
+#endif
+
+        return true;
+    }
+
+    RegisterGenerator::RegisterGenerator(RegisterChunk& registerChunk) :
+        m_registerChunk{ registerChunk }
+    {}
+
+    bool RegisterGenerator::translate(OpCode opcode, uint32_t operand, size_t line)
+    {
+        m_line = line;
+        switch (opcode)
+        {
+        case OpCode::Constant:
+        case OpCode::ConstantLong:
+            push(operand | RegisterChunk::CONSTANT_BIT);
+            return true;
+        case OpCode::Nil:   push(m_registerChunk.addLiteral(Value::makeNil()));       return true;
+        case OpCode::True:  push(m_registerChunk.addLiteral(Value::makeBool(true)));  return true;
+        case OpCode::False: push(m_registerChunk.addLiteral(Value::makeBool(false))); return true;
+        case OpCode::DefGlobalSlot:
+        case OpCode::DefGlobalSlotLong:
+            emit(RegisterOpCode::DefGlobal, operand, m_slots.back());
+            m_slots.pop_back();
+            return true;
+        case OpCode::GetGlobalSlot:
+        case OpCode::GetGlobalSlotLong: {
+            uint32_t reg = static_cast<uint32_t>(m_slots.size());
+            emitWrite(RegisterOpCode::GetGlobal, reg, operand);
+            push(reg);
+            return true;
+        }
+        case OpCode::SetGlobalSlot:
+        case OpCode::SetGlobalSlotLong:
+            emit(RegisterOpCode::SetGlobal, operand, m_slots.back());
+            return true;
+        case OpCode::GetLocal:
+        case OpCode::GetLocalLong:
+            // The local itself is read from now on, so it has to be in its slot.
+            materialize(operand);
+            push(operand);
+            return true;
+        case OpCode::SetLocal:
+        case OpCode::SetLocalLong:
+            setLocal(operand);
+            return true;
+        case OpCode::Negate:       unary(RegisterOpCode::Negate);        return true;
+        case OpCode::Not:          unary(RegisterOpCode::Not);           return true;
+        case OpCode::Add:          binary(RegisterOpCode::Add);          return true;
+        case OpCode::Subtract:     binary(RegisterOpCode::Subtract);     return true;
+        case OpCode::Multiply:     binary(RegisterOpCode::Multiply);     return true;
+        case OpCode::Divide:       binary(RegisterOpCode::Divide);       return true;
+        case OpCode::Equal:        binary(RegisterOpCode::Equal);        return true;
+        case OpCode::NotEqual:     binary(RegisterOpCode::NotEqual);     return true;
+        case OpCode::Less:         binary(RegisterOpCode::Less);         return true;
+        case OpCode::LessEqual:    binary(RegisterOpCode::LessEqual);    return true;
+        case OpCode::Greater:      binary(RegisterOpCode::Greater);      return true;
+        case OpCode::GreaterEqual: binary(RegisterOpCode::GreaterEqual); return true;
+        case OpCode::Print:
+            emit(RegisterOpCode::Print, m_slots.back(), 0);
+            m_slots.pop_back();
+            return true;
+        case OpCode::Pop:
+            m_slots.pop_back();
+            return true;
+        case OpCode::PopN:
+            m_slots.resize(m_slots.size() - operand);
+            return true;
+        case OpCode::Return:
+            emit(RegisterOpCode::Return, 0, 0);
+            m_isReachable = false;
+            return true;
+        // Superinstructions are split back into the sequences they replaced.
+        case OpCode::GetLocalPair:
+            return translate(OpCode::GetLocal, operand & 0xff, line) && translate(OpCode::GetLocal, operand >> 8, line);
+        case OpCode::AddLocals:
+            return translate(OpCode::GetLocalPair, operand, line) && translate(OpCode::Add, 0, line);
+        case OpCode::AddConstant:
+            return translate(OpCode::Constant, operand, line) && translate(OpCode::Add, 0, line);
+        case OpCode::PrintGlobalSlot:
+            return translate(OpCode::GetGlobalSlot, operand, line) && translate(OpCode::Print, 0, line);
+        case OpCode::NotLess:
+            return translate(OpCode::Less, 0, line) && translate(OpCode::Not, 0, line);
+        default:
+            return false;
+        }
+    }
+
+    bool RegisterGenerator::jump(OpCode opcode, size_t target, uint32_t loop, size_t line)
+    {
+        m_line = line;
+        materializeAll();
+
+        Label& label = m_labels[target];
+        if (label.depth == Label::UNKNOWN) label.depth = m_slots.size();
+        // Forward jumps are patched once their target is reached.
+        uint32_t index = label.index == Label::UNKNOWN ? 0 : static_cast<uint32_t>(label.index);
+        if (label.index == Label::UNKNOWN) label.jumps.emplace_back(m_registerChunk.getCodeSize());
+
+        switch (opcode)
+        {
+        case OpCode::Jump:
+        case OpCode::JumpLong:
+            emit(RegisterOpCode::Jump, index, 0);
+            m_isReachable = false;
+            return true;
+        case OpCode::JumpIfFalse:
+        case OpCode::JumpIfFalseLong:
+            emit(RegisterOpCode::JumpIfFalse, index, m_slots.back());
+            return true;
+        case OpCode::JumpIfTrue:
+        case OpCode::JumpIfTrueLong:
+            emit(RegisterOpCode::JumpIfTrue, index, m_slots.back());
+            return true;
+        case OpCode::Loop:
+        case OpCode::LoopLong:
+            emit(RegisterOpCode::Loop, index, loop);
+            m_isReachable = false;
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    bool RegisterGenerator::bindLabel(Label& label)
+    {
+        if (m_isReachable) {
+            materializeAll();
+            if (label.depth == Label::UNKNOWN) label.depth = m_slots.size();
+        }
+        else {
+            // Only jumps get here, they left every slot up to their depth in its own register.
+            if (label.depth == Label::UNKNOWN) return false;
+            m_slots.resize(label.depth);
+            for (size_t slot = 0; slot < m_slots.size(); slot++)
+                m_slots[slot] = static_cast<Operand>(slot);
+            m_isReachable = true;
+        }
+
+        label.index = m_registerChunk.getCodeSize();
+        m_lastLabelIndex = label.index;
+        for (size_t jump : label.jumps)
+            m_registerChunk.getInstruction(jump).a = static_cast<uint32_t>(label.index);
+        label.jumps.clear();
+        return true;
+    }
+
+    void RegisterGenerator::push(Operand operand)
+    {
+        m_slots.emplace_back(operand);
+        m_registerCount = std::max(m_registerCount, m_slots.size());
+    }
+
+    void RegisterGenerator::emit(RegisterOpCode opcode, uint32_t a, uint32_t b, uint32_t c)
+    {
+        m_registerChunk.write({ opcode, a, b, c }, m_line);
+    }
+
+    void RegisterGenerator::emitWrite(RegisterOpCode opcode, uint32_t a, uint32_t b, uint32_t c)
+    {
+        prepareWrite(a);
+        emit(opcode, a, b, c);
+    }
+
+    void RegisterGenerator::materialize(size_t slot)
+    {
+        if (slot >= m_slots.size() || m_slots[slot] == slot) return;
+
+        emitWrite(RegisterOpCode::Move, static_cast<uint32_t>(slot), m_slots[slot]);
+        m_slots[slot] = static_cast<Operand>(slot);
+    }
+
+    void RegisterGenerator::materializeAll()
+    {
+        for (size_t slot = 0; slot < m_slots.size(); slot++)
+            materialize(slot);
+    }
+
+    void RegisterGenerator::prepareWrite(uint32_t reg)
+    {
+        // Slots that still refer to the old value of the register get their own copy first.
+        for (size_t slot = 0; slot < m_slots.size(); slot++)
+            if (slot != reg && m_slots[slot] == reg) materialize(slot);
+    }
+
+    void RegisterGenerator::binary(RegisterOpCode opcode)
+    {
+        Operand rhs = m_slots.back();
+        m_slots.pop_back();
+        Operand lhs = m_slots.back();
+        m_slots.pop_back();
+
+        uint32_t reg = static_cast<uint32_t>(m_slots.size());
+        emitWrite(opcode, reg, lhs, rhs);
+        push(reg);
+    }
+
+    void RegisterGenerator::unary(RegisterOpCode opcode)
+    {
+        Operand operand = m_slots.back();
+        m_slots.pop_back();
+
+        uint32_t reg = static_cast<uint32_t>(m_slots.size());
+        emitWrite(opcode, reg, operand);
+        push(reg);
+    }
+
+    void RegisterGenerator::setLocal(uint32_t slot)
+    {
+        size_t codeSize = m_registerChunk.getCodeSize();
+        prepareWrite(slot);
+
+        // A value computed into the top slot by the last instruction can be computed straight into the local.
+        // Nothing can have read the top slot yet, and operands are read before the result is written.
+        // Code jumping to a label in between would leave the value in the top slot, so the last instruction
+        // has to be after the last label.
+        uint32_t top = static_cast<uint32_t>(m_slots.size() - 1);
+        if (codeSize > m_lastLabelIndex && m_registerChunk.getCodeSize() == codeSize && m_slots[top] == top) {
+            RegisterInstruction& last = m_registerChunk.getInstruction(codeSize - 1);
+            if (last.a == top && writesRegister(last.opcode)) {
+                last.a = slot;
+                m_slots[top] = slot;
+                m_slots[slot] = slot;
+                return;
+            }
+        }
+
+        emit(RegisterOpCode::Move, slot, m_slots[top]);
+        m_slots[slot] = slot;
+    }
+
+    bool RegisterGenerator::writesRegister(RegisterOpCode opcode)
+    {
+        switch (opcode)
+        {
+        case RegisterOpCode::DefGlobal:
+        case RegisterOpCode::SetGlobal:
+        case RegisterOpCode::Print:
+        case RegisterOpCode::Jump:
+        case RegisterOpCode::JumpIfFalse:
+        case RegisterOpCode::JumpIfTrue:
+        case RegisterOpCode::Loop:
+        case RegisterOpCode::Return:
+            return false;
+        default:
+            return true;
+        }
+    }
+
+} // namespace Lux
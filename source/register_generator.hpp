@@ -0,0 +1,62 @@
+#pragma once
+#include "common.hpp"
+#include "chunk.hpp"
+#include "register_chunk.hpp"
+
+#include <unordered_map>
+#include <vector>
+
+namespace Lux {
+
+    // Second code generator: turns a finished stack chunk into register code by tracking
+    // where each stack slot's value currently lives instead of copying it around.
+    // Constants and locals are used directly as operands and only stored in their slot
+    // when the slot itself is read or a local they alias is about to be overwritten.
+    // At jumps and jump targets every slot is stored, so code after a target doesn't depend on
+    // which way it was reached.
+    class RegisterGenerator
+    {
+    public:
+        // Returns false if the chunk uses instructions the register VM doesn't support
+        // (globals referenced by name), such chunks have to run on the stack VM.
+        static bool generate(const Chunk& chunk, RegisterChunk& registerChunk);
+    private:
+        // RK operand holding the value of a stack slot; a slot is "home" when its operand is its own register.
+        using Operand = uint32_t;
+
+        // Jump target in the stack code.
+        struct Label {
+            static constexpr size_t UNKNOWN = SIZE_MAX;
+
+            size_t depth = UNKNOWN;         // stack depth jumps arrive with
+            size_t index = UNKNOWN;         // register instruction it became, once reached
+            std::vector<size_t> jumps;      // forward jumps to patch once it's reached
+        };
+
+        explicit RegisterGenerator(RegisterChunk& registerChunk);
+
+        bool translate(OpCode opcode, uint32_t operand, size_t line);
+        bool jump(OpCode opcode, size_t target, uint32_t loop, size_t line);
+        bool bindLabel(Label& label);
+        void push(Operand operand);
+        void emit(RegisterOpCode opcode, uint32_t a, uint32_t b, uint32_t c = 0);
+        void emitWrite(RegisterOpCode opcode, uint32_t a, uint32_t b, uint32_t c = 0);
+        void materialize(size_t slot);
+        void materializeAll();
+        void prepareWrite(uint32_t reg);
+        void binary(RegisterOpCode opcode);
+        void unary(RegisterOpCode opcode);
+        void setLocal(uint32_t slot);
+
+        static bool writesRegister(RegisterOpCode opcode);
+
+        RegisterChunk& m_registerChunk;
+        std::vector<Operand> m_slots;
+        std::unordered_map<size_t, Label> m_labels; // stack code offset -> label
+        size_t m_lastLabelIndex = 0;                // register instruction the last label became
+        bool m_isReachable = true;                  // false after an unconditional jump until the next label
+        size_t m_line = 0;
+        size_t m_registerCount = 0;
+    };
+
+} // namespace Lux
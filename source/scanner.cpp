@@ -84,8 +84,8 @@ namespace Lux {
                 advance();
                 break;
             case '/':
-                if (peekNext() == '/')
-                    while (*m_current != '\n' && *m_current != '\0') advance();
+                if (peekNext() != '/') return;
+                while (*m_current != '\n' && *m_current != '\0') advance();
                 break;
             default:
                 return;
@@ -1,100 +1,205 @@
 #include "hash_table.hpp"
 
-#include <utility>
+#include <bit>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LUX_HASH_TABLE_SSE2
+#endif
 
 namespace Lux {
 
-    HashTable::HashTable() :
-        m_capacity{ 8 },
-        m_size{ 0 },
-        m_entries{ new Entry[m_capacity] }
-    {}
+    namespace {
+
+        constexpr uint8_t EMPTY = 0x80;
+        constexpr uint8_t DELETED = 0xFE;
+        // Full entries have the high bit clear, so empty and deleted ones are found by it.
+
+        uint8_t controlByte(size_t hash) { return static_cast<uint8_t>(hash & 0x7F); }
+        size_t groupIndex(size_t hash) { return hash >> 7; }
+
+        // Control bytes of one group, the matches are bit masks with a bit per entry.
+        struct Group
+        {
+#ifdef LUX_HASH_TABLE_SSE2
+            explicit Group(const uint8_t* control) : bytes{ _mm_loadu_si128(reinterpret_cast<const __m128i*>(control)) } {}
+
+            uint32_t match(uint8_t byte) const
+            {
+                return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(static_cast<char>(byte)))));
+            }
+            uint32_t matchEmpty() const { return match(EMPTY); }
+            uint32_t matchEmptyOrDeleted() const { return static_cast<uint32_t>(_mm_movemask_epi8(bytes)); }
+
+            __m128i bytes;
+#else
+            explicit Group(const uint8_t* control) : control{ control } {}
+
+            uint32_t match(uint8_t byte) const
+            {
+                uint32_t mask = 0;
+                for (uint32_t i = 0; i < 16; i++)
+                    if (control[i] == byte) mask |= 1u << i;
+                return mask;
+            }
+            uint32_t matchEmpty() const { return match(EMPTY); }
+            uint32_t matchEmptyOrDeleted() const
+            {
+                uint32_t mask = 0;
+                for (uint32_t i = 0; i < 16; i++)
+                    if (control[i] & 0x80) mask |= 1u << i;
+                return mask;
+            }
+
+            const uint8_t* control;
+#endif
+        };
+
+    } // namespace
+
+    HashTable::HashTable()
+    {
+        allocate(MIN_CAPACITY);
+    }
 
     HashTable::~HashTable()
     {
+        delete[] m_control;
         delete[] m_entries;
     }
 
     void HashTable::clear()
     {
-        m_capacity = 8;
-        m_size = 0;
+        bumpVersion();
+        delete[] m_control;
         delete[] m_entries;
-        m_entries = new Entry[m_capacity];
+        allocate(MIN_CAPACITY);
     }
 
-    void HashTable::insert(String key, Value value)
+    void HashTable::insert(String* key, Value value)
     {
-        adjustCapacity();
-        Entry& entry = find(key);
-        if (entry.key.isNull() && entry.value.isNil()) m_size++;
+        Entry* entry = find(key);
+        if (entry) {
+            entry->value = value;
+            return;
+        }
 
-        entry.key = std::move(key);
-        entry.value = value;
+        reserveOne();
+        uint32_t hash = static_cast<uint32_t>(key->hash());
+        size_t index = findFreeIndex(hash);
+        if (m_control[index] == DELETED) m_deleted--;
+        m_control[index] = controlByte(hash);
+        m_entries[index] = { key, hash, value };
+        m_size++;
     }
 
-    bool HashTable::remove(const String& key)
+    bool HashTable::remove(const String* key)
     {
-        if (m_size == 0) return false;
-        
-        Entry& entry = find(key);
-        if (entry.key.isNull()) return false;
-
-        // Place a tombstone in the entry.
-        entry.key = String{};
-        entry.value = Value::makeBool(true);
+        Entry* entry = find(key);
+        if (!entry) return false;
+
+        bumpVersion();
+        size_t index = entry - m_entries;
+        // Lookups stop at a group with an empty entry, so if this group already has one, nothing
+        // was placed past it and the entry can become empty too. Otherwise it's a tombstone.
+        if (Group{ m_control + (index & ~(GROUP_SIZE - 1)) }.matchEmpty())
+            m_control[index] = EMPTY;
+        else {
+            m_control[index] = DELETED;
+            m_deleted++;
+        }
+        *entry = {};
+        m_size--;
         return true;
     }
 
-    bool HashTable::contains(const String& key)
+    HashTable::Entry* HashTable::find(const String* key) const
     {
-        return !find(key).key.isNull();
+        size_t hash = key->hash();
+        uint8_t byte = controlByte(hash);
+        size_t groupMask = m_capacity / GROUP_SIZE - 1;
+        size_t group = groupIndex(hash) & groupMask;
+        // Triangular probing visits every group when their count is a power of two.
+        for (size_t step = 1;; step++) {
+            Group control{ m_control + group * GROUP_SIZE };
+            for (uint32_t match = control.match(byte); match; match &= match - 1) {
+                Entry& entry = m_entries[group * GROUP_SIZE + std::countr_zero(match)];
+                if (entry.key == key) return &entry;
+            }
+            if (control.matchEmpty()) return nullptr;
+            group = (group + step) & groupMask;
+        }
     }
 
-    HashTable::Entry& HashTable::find(const String& key)
+    String* HashTable::findString(const char* chars, size_t length, uint32_t hash) const
     {
-        size_t index = key.hash() % m_capacity;
-        Entry* tombstone = nullptr;
-        while (true)
-        {
-            Entry& entry = m_entries[index];
-
-            if (entry.key.isNull())
-            {
-                if (entry.value.isNil())
-                    return tombstone != nullptr ? *tombstone : entry; // Empty entry.
-                else if (tombstone == nullptr)
-                    tombstone = &entry; // We found a tombstone.
+        uint8_t byte = controlByte(hash);
+        size_t groupMask = m_capacity / GROUP_SIZE - 1;
+        size_t group = groupIndex(hash) & groupMask;
+        for (size_t step = 1;; step++) {
+            Group control{ m_control + group * GROUP_SIZE };
+            for (uint32_t match = control.match(byte); match; match &= match - 1) {
+                const Entry& entry = m_entries[group * GROUP_SIZE + std::countr_zero(match)];
+                if (entry.hash == hash &&
+                    entry.key->length() == length &&
+                    std::memcmp(entry.key->data(), chars, length) == 0)
+                    return entry.key;
             }
-            else if (entry.key == key)
-                return entry; // We found the key.
-
-            index = (index + 1) % m_capacity;
+            if (control.matchEmpty()) return nullptr;
+            group = (group + step) & groupMask;
         }
     }
 
-    void HashTable::adjustCapacity()
+    void HashTable::allocate(size_t capacity)
     {
-        if (m_size + 1 < m_capacity * MAX_LOAD_FACTOR) return;
+        m_capacity = capacity;
+        m_size = 0;
+        m_deleted = 0;
+        m_control = new uint8_t[capacity];
+        std::memset(m_control, EMPTY, capacity);
+        m_entries = new Entry[capacity];
+    }
 
-        size_t newCapacity = m_capacity + (m_capacity >> 1);
-        Entry* newEntries = new Entry[newCapacity];
+    void HashTable::reserveOne()
+    {
+        // Load factor of at most 7/8, tombstones count as used because they don't end lookups.
+        if (m_size + m_deleted + 1 <= m_capacity - m_capacity / 8) return;
 
-        m_size = 0;
-        for (size_t i = 0; i < m_capacity; i++)
-        {
-            const Entry& entry = m_entries[i];
-            if (entry.key.isNull()) continue;
+        // If mostly tombstones fill the table, dropping them is enough.
+        rehash(m_size + 1 > m_capacity / 2 ? m_capacity * 2 : m_capacity);
+    }
 
-            Entry& dest = find(entry.key);
-            dest.key = entry.key;
-            dest.value = entry.value;
+    void HashTable::rehash(size_t capacity)
+    {
+        uint8_t* oldControl = m_control;
+        Entry* oldEntries = m_entries;
+        size_t oldCapacity = m_capacity;
+        bumpVersion();
+        allocate(capacity);
+
+        for (size_t i = 0; i < oldCapacity; i++) {
+            if (oldControl[i] & 0x80) continue;
+
+            size_t index = findFreeIndex(oldEntries[i].hash);
+            m_control[index] = controlByte(oldEntries[i].hash);
+            m_entries[index] = oldEntries[i];
             m_size++;
         }
 
-        delete[] m_entries;
-        m_capacity = newCapacity;
-        m_entries = newEntries;
+        delete[] oldControl;
+        delete[] oldEntries;
+    }
+
+    size_t HashTable::findFreeIndex(size_t hash) const
+    {
+        size_t groupMask = m_capacity / GROUP_SIZE - 1;
+        size_t group = groupIndex(hash) & groupMask;
+        for (size_t step = 1;; step++) {
+            uint32_t free = Group{ m_control + group * GROUP_SIZE }.matchEmptyOrDeleted();
+            if (free) return group * GROUP_SIZE + std::countr_zero(free);
+            group = (group + step) & groupMask;
+        }
     }
 
 } // namespace Lux
@@ -4,12 +4,20 @@
 
 namespace Lux {
 
+    // Open addressing table in the style of Swiss tables. Besides the entries there is an array
+    // of control bytes, one per entry: empty, deleted or the low 7 bits of the key's hash.
+    // Lookups start in the group of 16 entries picked by the rest of the hash and compare
+    // the whole group's control bytes at once, keys are compared only for matching bytes.
+    // Keys are interned strings, so they are compared by pointer. The table never copies their
+    // characters, it only keeps pointers to them together with their hashes, so growing the table
+    // and looking strings up by contents don't touch keys that can't match.
     class HashTable
     {
     public:
         struct Entry
         {
-            String key{};
+            String* key = nullptr;
+            uint32_t hash = 0; // key's hash
             Value value = Value::makeNil();
         };
 
@@ -17,21 +25,39 @@ namespace Lux {
         ~HashTable();
 
         void clear();
-        void insert(String key, Value value);
-        bool remove(const String& key);
-        bool contains(const String& key);
-        Entry& find(const String& key);
+        void insert(String* key, Value value);
+        bool remove(const String* key);
+        bool contains(const String* key) const { return find(key) != nullptr; }
+        // nullptr if the key is not in the table.
+        Entry* find(const String* key) const;
+        // Looks a key up by its contents, used to intern new strings.
+        String* findString(const char* chars, size_t length, uint32_t hash) const;
+
+        size_t size() const { return m_size; }
+        // Changes whenever entries are removed or moved, so lookups stay valid while it's the same.
+        // It never returns 0.
+        uint32_t getVersion() const { return m_version; }
 
         HashTable(const HashTable&) = delete;
         HashTable& operator=(const HashTable&) = delete;
     private:
-        static constexpr float MAX_LOAD_FACTOR = 0.75;
-
-        void adjustCapacity();
-
-        size_t m_capacity;
-        size_t m_size;
-        Entry* m_entries;
+        static constexpr size_t GROUP_SIZE = 16;
+        static constexpr size_t MIN_CAPACITY = GROUP_SIZE;
+
+        void allocate(size_t capacity);
+        void bumpVersion() { if (++m_version == 0) m_version = 1; }
+        // Makes room for one more entry, reclaiming deleted entries or growing the table.
+        void reserveOne();
+        void rehash(size_t capacity);
+        // Index of the first empty or deleted entry on the key's probe sequence.
+        size_t findFreeIndex(size_t hash) const;
+
+        size_t m_capacity = 0; // Power of two, multiple of GROUP_SIZE.
+        size_t m_size = 0;
+        size_t m_deleted = 0;
+        uint32_t m_version = 1;
+        uint8_t* m_control = nullptr;
+        Entry* m_entries = nullptr;
     };
 
 } // namespace Lux
@@ -1,39 +1,42 @@
 #include "object.hpp"
+#include "rope.hpp"
 #include "string.hpp"
 
 #include <cstdio>
 
 namespace Lux {
 
-    String *Object::asString()
-    {
-        return dynamic_cast<String*>(this);
-    }
-
-    const String *Object::asString() const
-    {
-        return dynamic_cast<const String*>(this);
-    }
-
-    bool Object::operator==(const Object &rhs) const
+    void printObject(Object *object)
     {
-        if (m_type != rhs.m_type) return false;
-
-        switch (m_type)
+        switch (object->getType())
         {
-        case Type::String: return *asString() == *rhs.asString();
+        case Object::Type::String:
+            std::fwrite(object->asString()->data(), 1, object->asString()->length(), stdout);
+            break;
+        case Object::Type::Rope: {
+            std::string chars;
+            printObject(object, chars);
+            std::fwrite(chars.data(), 1, chars.size(), stdout);
+            break;
+        }
         }
-
-        return false;
     }
 
-    void printObject(Object *object)
+    void printObject(Object *object, std::string& output)
     {
         switch (object->getType())
         {
         case Object::Type::String:
-            std::printf("%s", object->asString()->cstr());
+            output.append(object->asString()->data(), object->asString()->length());
             break;
+        case Object::Type::Rope: {
+            // Printing doesn't flatten the rope, it would need the heap.
+            const Rope* rope = object->asRope();
+            size_t size = output.size();
+            output.resize(size + rope->length());
+            rope->copyTo(output.data() + size);
+            break;
+        }
         }
     }
 
@@ -1,31 +1,57 @@
 #pragma once
 #include "common.hpp"
 
+#include <string>
+
 namespace Lux {
 
+    class Rope;
     class String;
 
+    // Base of every object allocated by the Heap. There are no virtual functions, code that depends
+    // on the kind of the object switches on its type, so the header is only the list link plus one
+    // word with the type, the Heap's bits and flags of the object kind.
     class Object
     {
     public:
-        enum class Type {
-            String
+        enum class Type : uint8_t {
+            String,
+            Rope
         };
 
         explicit Object(Type type) : m_type{ type } {}
-        virtual ~Object() = default;
 
         Type getType() const { return m_type; }
 
         bool isString() const { return m_type == Type::String; }
+        bool isRope() const { return m_type == Type::Rope; }
+        // Strings and ropes are the same type for scripts.
+        bool isStringOrRope() const { return isString() || isRope(); }
+        // The object must be of that type, they are defined with the types.
         String *asString();
         const String *asString() const;
-
-        bool operator==(const Object &rhs) const;
+        Rope *asRope();
+        const Rope *asRope() const;
+    protected:
+        // Destroyed by the Heap, which knows the actual type.
+        ~Object() = default;
     private:
+        friend class Heap;
+
+        Object* m_next = nullptr;
         Type m_type;
+        // Bookkeeping of the Heap that allocated this object.
+        bool m_isMarked : 1 = false;
+        bool m_isOld : 1 = false;
+        bool m_isShared : 1 = false; // Owned by a frozen heap, other heaps never mark it.
+    protected:
+        mutable uint16_t m_flags = 0; // Free for the kind of the object.
     };
 
+    // Type, mark bits and flags share the word after m_next (16 bytes on 64-bit targets).
+    static_assert(sizeof(Object) <= 2 * sizeof(Object*));
+
     void printObject(Object *object);
+    void printObject(Object *object, std::string& output);
 
 } // namespace Lux
@@ -0,0 +1,40 @@
+#include "rope.hpp"
+#include "string.hpp"
+
+#include <cstring>
+#include <vector>
+
+namespace Lux {
+
+    void Rope::copyTo(char* buffer) const
+    {
+        // Filled from the end, so ropes built by appending in a loop (deep on the left side)
+        // never have more than one node waiting.
+        char* end = buffer + m_length;
+        std::vector<const Object*> pending{ this };
+        while (!pending.empty()) {
+            const Object* object = pending.back();
+            pending.pop_back();
+
+            while (object->isRope()) {
+                const Rope* rope = object->asRope();
+                if (rope->m_flat) {
+                    object = rope->m_flat;
+                    break;
+                }
+                pending.push_back(rope->m_lhs);
+                object = rope->m_rhs;
+            }
+
+            const String* string = object->asString();
+            end -= string->length();
+            std::memcpy(end, string->data(), string->length());
+        }
+    }
+
+    size_t Rope::lengthOf(const Object* string)
+    {
+        return string->isRope() ? string->asRope()->length() : string->asString()->length();
+    }
+
+} // namespace Lux
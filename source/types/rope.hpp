@@ -0,0 +1,47 @@
+#pragma once
+#include "object.hpp"
+
+namespace Lux {
+
+    class String;
+
+    // String built by concatenation whose characters are not copied until they're needed.
+    // Both sides are Strings or Ropes. Before a rope is compared it's flattened by the Heap
+    // into a String, which the rope then keeps instead of its sides.
+    class Rope : public Object
+    {
+    public:
+        // Shorter concatenations are copied right away, a node would not be worth it.
+        static constexpr size_t MIN_LENGTH = 64;
+
+        size_t length() const { return m_length; }
+        String* getFlat() const { return m_flat; }
+
+        // Writes length() characters to buffer, no null terminator.
+        void copyTo(char* buffer) const;
+
+        // Length of a String or a Rope.
+        static size_t lengthOf(const Object* string);
+
+        Rope(const Rope&) = delete;
+        Rope& operator=(const Rope&) = delete;
+    private:
+        friend class Heap;
+
+        Rope(Object* lhs, Object* rhs, size_t length) :
+            Object{ Type::Rope },
+            m_lhs{ lhs },
+            m_rhs{ rhs },
+            m_length{ length }
+        {}
+
+        Object* m_lhs;
+        Object* m_rhs;
+        String* m_flat = nullptr;
+        size_t m_length;
+    };
+
+    inline Rope* Object::asRope() { return static_cast<Rope*>(this); }
+    inline const Rope* Object::asRope() const { return static_cast<const Rope*>(this); }
+
+} // namespace Lux
@@ -3,32 +3,84 @@
 
 namespace Lux {
 
-    // TODO: implement Strings that doesn't own buffer
-    // TODO: remember that const string can be easly interned
+    uint32_t hashString(const char* str, size_t length);
+
+    // Strings are immutable and created only by the Heap. Strings the compiler creates are interned,
+    // so equal interned strings are always the same object. Strings built at runtime are not,
+    // they are hashed only when the hash is first needed (see VM::equals).
+    // Interned strings are hashed up front, so frozen heaps can share them between threads.
+    // Characters (null-terminated) are stored right after the object in the same allocation,
+    // unless the string is a slice: then they are a part of the parent string's characters,
+    // which the slice keeps alive.
     class String : public Object
     {
     public:
-        String() : Object(Object::Type::String) {}
-        String(String&& other) noexcept;
-        String(const String& other);
-        String(const char* str, size_t length);
-        ~String();
-
-        static String* create(const char* str, size_t length) { return new String(str, length); }
+        // length() characters, null-terminated only if the string is not a slice.
+        const char* data() const { return m_chars; }
+        size_t length() const { return m_length; }
+        size_t hash() const
+        {
+            if (!(m_flags & HAS_HASH)) {
+                m_hash = hashString(m_chars, m_length);
+                m_flags |= HAS_HASH;
+            }
+            return m_hash;
+        }
+        bool isInterned() const { return m_flags & INTERNED; }
+        bool isSlice() const { return m_parent != nullptr; }
+        String* getParent() const { return m_parent; }
 
-        const char* cstr() const { return m_buffer; }
-        size_t hash() const { return m_hash; }
+        // Only interned strings can be compared by pointer.
+        bool operator==(const String& rhs) const { return this == &rhs; }
 
-        bool isNull() const { return m_buffer == nullptr; }
+        static size_t getAllocationSize(size_t length) { return sizeof(String) + length + 1; }
+        size_t getAllocationSize() const { return isSlice() ? sizeof(String) : getAllocationSize(m_length); }
 
-        bool operator==(const String& rhs) const;
-        String& operator+=(const String& rhs);
-        String& operator=(String&& other) noexcept;
-        String& operator=(const String& other);
+        String(const String&) = delete;
+        String& operator=(const String&) = delete;
     private:
-        size_t m_size = 0;
-        uint32_t m_hash = 0;
-        char* m_buffer = nullptr;
+        friend class Heap;
+
+        // Bits of m_flags.
+        static constexpr uint16_t HAS_HASH = 1 << 0;
+        static constexpr uint16_t INTERNED = 1 << 1;
+
+        // Interned string.
+        String(size_t length, uint32_t hash) :
+            Object{ Type::String },
+            m_hash{ hash },
+            m_chars{ reinterpret_cast<const char*>(this + 1) },
+            m_length{ length }
+        {
+            m_flags = HAS_HASH | INTERNED;
+        }
+
+        explicit String(size_t length) :
+            Object{ Type::String },
+            m_chars{ reinterpret_cast<const char*>(this + 1) },
+            m_length{ length }
+        {}
+
+        // Interned slice, chars point into parent's characters.
+        String(String* parent, const char* chars, size_t length, uint32_t hash) :
+            Object{ Type::String },
+            m_hash{ hash },
+            m_chars{ chars },
+            m_parent{ parent },
+            m_length{ length }
+        {
+            m_flags = HAS_HASH | INTERNED;
+        }
+
+        char* chars() { return reinterpret_cast<char*>(this + 1); }
+
+        mutable uint32_t m_hash = 0; // Fits in the padding at the end of the Object header.
+        const char* m_chars;
+        String* m_parent = nullptr;
+        size_t m_length;
     };
 
+    inline String* Object::asString() { return static_cast<String*>(this); }
+    inline const String* Object::asString() const { return static_cast<const String*>(this); }
+
 } // namespace Lux
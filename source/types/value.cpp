@@ -4,69 +4,74 @@
 
 namespace Lux {
 
-    Value Value::makeNil()
-    {
-        Value value;
-        value.type = Type::Nil;
-        return value;
-    }
-
-    Value Value::makeBool(bool boolean)
-    {
-        Value value;
-        value.type = Type::Bool;
-        value.boolean = boolean;
-        return value;
-    }
-
-    Value Value::makeNumber(double number)
-    {
-        Value value;
-        value.type = Type::Number;
-        value.number = number;
-        return value;
-    }
-
-    Value Value::makeObject(Object *object)
-    {
-        Value value;
-        value.type = Type::Object;
-        value.object = object;
-        return value;
-    }
-
     bool Value::operator==(Value rhs) const
     {
+#ifdef LUX_NAN_BOXING
+        // Objects are equal only when they are the same object (strings are interned).
+        if (isNumber() && rhs.isNumber()) return asNumber() == rhs.asNumber();
+        return bits == rhs.bits;
+#else
         if (type != rhs.type) return false;
 
         switch (type)
         {
         case Type::Bool:   return boolean == rhs.boolean;
-        case Type::Nil:    return true;
+        case Type::Nil:
+        case Type::Undefined: return true;
         case Type::Number: return number == rhs.number;
-        case Type::Object: return *object == *rhs.object;
+        case Type::Object: return object == rhs.object; // Strings are interned.
         }
 
         return false;
+#endif
     }
 
     void printValue(Value value)
     {
-        switch (value.type)
+        switch (value.getType())
         {
         case Value::Type::Bool:
-            std::printf(value.boolean ? "true" : "false");
+            std::printf(value.asBool() ? "true" : "false");
             break;
         case Value::Type::Nil:
             std::printf("nil");
             break;
         case Value::Type::Number:
-            std::printf("%g", value.number);
+            std::printf("%g", value.asNumber());
             break;
         case Value::Type::Object:
-            printObject(value.object);
+            printObject(value.asObject());
+            break;
+        case Value::Type::Undefined:
+            std::printf("undefined");
+            break;
         }
         
     }
 
+    void printValue(Value value, std::string& output)
+    {
+        switch (value.getType())
+        {
+        case Value::Type::Bool:
+            output += value.asBool() ? "true" : "false";
+            break;
+        case Value::Type::Nil:
+            output += "nil";
+            break;
+        case Value::Type::Number: {
+            char buffer[32];
+            int length = std::snprintf(buffer, sizeof(buffer), "%g", value.asNumber());
+            output.append(buffer, length);
+            break;
+        }
+        case Value::Type::Object:
+            printObject(value.asObject(), output);
+            break;
+        case Value::Type::Undefined:
+            output += "undefined";
+            break;
+        }
+    }
+
 } // namespace Lux
@@ -1,14 +1,76 @@
 #pragma once
 #include "object.hpp"
 
+#include <string>
+
+#ifdef LUX_NAN_BOXING
+#include <bit>
+#endif
+
 namespace Lux {
 
+#ifdef LUX_NAN_BOXING
+    // Packs every value into a single 64-bit word. Numbers are stored as plain doubles;
+    // all other values live inside the payload of a quiet NaN:
+    //  - nil/false/true use the low bits of the payload as a tag,
+    //  - objects additionally set the sign bit and keep the pointer in the low 48 bits.
+    struct Value {
+        enum class Type {
+            Nil,
+            Bool,
+            Number,
+            Object,
+            Undefined // Internal marker for global slots that were not defined yet.
+        };
+
+        uint64_t bits;
+
+        Type getType() const {
+            if (isNumber()) return Type::Number;
+            if (isObject()) return Type::Object;
+            if (isUndefined()) return Type::Undefined;
+            return isNil() ? Type::Nil : Type::Bool;
+        }
+
+        bool isNil() const { return bits == NIL_BITS; }
+        bool isBool() const { return (bits | 1) == TRUE_BITS; }
+        bool isNumber() const { return (bits & QNAN) != QNAN; }
+        bool isObject() const { return (bits & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT); }
+        bool isUndefined() const { return bits == UNDEFINED_BITS; }
+        bool isString() const { return isObject() && asObject()->isString(); }
+        bool isStringOrRope() const { return isObject() && asObject()->isStringOrRope(); }
+
+        bool asBool() const { return bits == TRUE_BITS; }
+        double asNumber() const { return std::bit_cast<double>(bits); }
+        Object* asObject() const { return reinterpret_cast<Object*>(static_cast<uintptr_t>(bits & ~(QNAN | SIGN_BIT))); }
+
+        static Value makeNil() { return { NIL_BITS }; }
+        static Value makeBool(bool boolean) { return { boolean ? TRUE_BITS : FALSE_BITS }; }
+        static Value makeNumber(double number) { return { std::bit_cast<uint64_t>(number) }; }
+        static Value makeObject(Object* object) { return { QNAN | SIGN_BIT | static_cast<uint64_t>(reinterpret_cast<uintptr_t>(object)) }; }
+        static Value makeUndefined() { return { UNDEFINED_BITS }; }
+
+        operator bool() const { return !(isNil() || bits == FALSE_BITS); }
+        bool operator==(Value rhs) const;
+        bool operator!=(Value rhs) const { return !(*this == rhs); }
+    private:
+        static constexpr uint64_t SIGN_BIT = 0x8000000000000000;
+        static constexpr uint64_t QNAN = 0x7ffc000000000000;
+        static constexpr uint64_t NIL_BITS = QNAN | 1;
+        static constexpr uint64_t FALSE_BITS = QNAN | 2;
+        static constexpr uint64_t TRUE_BITS = QNAN | 3;
+        static constexpr uint64_t UNDEFINED_BITS = QNAN | 4;
+    };
+
+    static_assert(sizeof(Value) == 8);
+#else
     struct Value {
         enum class Type {
             Nil,
             Bool,
             Number,
-            Object
+            Object,
+            Undefined // Internal marker for global slots that were not defined yet.
         };
         
         Type type;
@@ -18,22 +80,34 @@ namespace Lux {
             Object *object;
         };
 
+        Type getType() const { return type; }
+
         bool isNil() const { return type == Type::Nil; }
         bool isBool() const { return type == Type::Bool; }
         bool isNumber() const { return type == Type::Number; }
         bool isObject() const { return type == Type::Object; }
+        bool isUndefined() const { return type == Type::Undefined; }
         bool isString() const { return isObject() && object->isString(); }
+        bool isStringOrRope() const { return isObject() && object->isStringOrRope(); }
+
+        bool asBool() const { return boolean; }
+        double asNumber() const { return number; }
+        Object* asObject() const { return object; }
 
-        static Value makeNil();
-        static Value makeBool(bool boolean);
-        static Value makeNumber(double number);
-        static Value makeObject(Object *object);
+        static Value makeNil() { Value value; value.type = Type::Nil; return value; }
+        static Value makeBool(bool boolean) { Value value; value.type = Type::Bool; value.boolean = boolean; return value; }
+        static Value makeNumber(double number) { Value value; value.type = Type::Number; value.number = number; return value; }
+        static Value makeObject(Object* object) { Value value; value.type = Type::Object; value.object = object; return value; }
+        static Value makeUndefined() { Value value; value.type = Type::Undefined; return value; }
 
         operator bool() const { return !(isNil() || (isBool() && !boolean)); }
         bool operator==(Value rhs) const;
         bool operator!=(Value rhs) const { return !(*this == rhs); }
     };
+#endif
 
     void printValue(Value value);
+    // Appends the same text printValue would print.
+    void printValue(Value value, std::string& output);
 
 } // namespace Lux
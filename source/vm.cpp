@@ -2,183 +2,736 @@
 #include "chunk.hpp"
 #include "debug.hpp"
 #include "compiler.hpp"
+#include "optimizer.hpp"
+#include "register_generator.hpp"
+#include "types/rope.hpp"
+#include "types/string.hpp"
+
+#include <algorithm>
+#include <cstring>
 
 namespace Lux {
 
+    VM::VM(size_t stackCapacity, Heap::Config heapConfig) :
+        m_stackCapacity{ stackCapacity },
+        m_stack{ new Value[stackCapacity] },
+        m_stackTop{ m_stack.get() },
+        m_heap{ heapConfig }
+    {}
+
     InterpretResult VM::interpret(const char *source)
     {
-        Compiler compiler;
         Chunk chunk;
-        if (!compiler.compile(source, chunk)) return InterpretResult::CompilationError;
+        std::unique_ptr<MappedFile> cachedFile;
+        if (m_cache) cachedFile = m_cache->load(source, m_optimizationLevel, chunk, m_heap);
+        if (!cachedFile) {
+            if (!compile(source, chunk)) return InterpretResult::CompilationError;
+            if (m_cache) m_cache->store(source, m_optimizationLevel, chunk);
+        }
+
+        // Nobody else sees the chunk, so its own code is quickened in place. Mapped code stays read-only.
+        return interpret(chunk, chunk.getOwnCode());
+    }
+
+    InterpretResult VM::interpret(const Chunk& chunk)
+    {
+        return interpret(chunk, nullptr);
+    }
+
+    InterpretResult VM::interpret(const Chunk& chunk, uint8_t* quickenableCode)
+    {
+        bindGlobals(chunk);
+        m_boundProgramId = 0;
+        return execute(chunk, nullptr, quickenableCode);
+    }
+
+    InterpretResult VM::run(const Program& program, Globals globals)
+    {
+        const Chunk& chunk = program.getChunk();
+        m_keptGlobals.clear();
+        if (m_boundProgramId != program.getId()) {
+            bindGlobals(chunk);
+            m_boundProgramId = program.getId();
+        }
+        else if (globals == Globals::Fresh) {
+            // Slots stay bound to the same names, only globals added by name since have to be dropped.
+            if (m_globals.size() == chunk.getGlobalNames().size())
+                std::fill(m_globals.begin(), m_globals.end(), Value::makeUndefined());
+            else
+                bindGlobals(chunk);
+        }
+        else {
+            // The program defines its globals again, the ones the previous run defined keep their values.
+            m_keptGlobals.resize(m_globals.size());
+            for (size_t slot = 0; slot < m_globals.size(); slot++)
+                m_keptGlobals[slot] = !m_globals[slot].isUndefined();
+        }
+
+        // Programs can be shared by VMs on other threads, so each VM quickens its own copy of the code.
+        // The copy is kept for the program's next runs, they start with its instructions already specialized.
+        if (m_programCodeId != program.getId()) {
+            m_programCode.assign(chunk.getCodeRawPtr(), chunk.getCodeRawPtr() + chunk.getCodeSize());
+            m_programCodeId = program.getId();
+        }
+
+        // Strings created by the program's code have to be the same objects as its equal constants.
+        m_heap.setSharedStrings(&program.getHeap());
+        InterpretResult result = execute(chunk, program.getRegisterChunk(), m_programCode.data());
+        m_heap.setSharedStrings(nullptr);
+        return result;
+    }
 
+    InterpretResult VM::execute(const Chunk& chunk, const RegisterChunk* registerChunk, uint8_t* quickenableCode)
+    {
         m_currentChunk = &chunk;
-        m_IP = m_currentChunk->getCodeRawPtr();
-        m_globals.clear();
+        m_codeStart = quickenableCode ? quickenableCode : chunk.getCodeRawPtr();
+        m_quickenableCode = quickenableCode;
+        m_IP = m_codeStart;
+        m_backedgeCounts.assign(chunk.getLoopCount(), 0);
+        // Sized by the first name-based access, most chunks only use global slots and never need them.
+        m_globalCaches.clear();
+        m_globalCacheMisses = 0;
+        resetStack();
+        if (m_heap.needsCollection()) collectGarbage();
+
+        if (chunk.getMaxStackDepth() > m_stackCapacity) {
+            m_IP += chunk.getMaxStackDepthOffset() + 1;
+            runtimeError("Stack overflow.");
+            return InterpretResult::RuntimeError;
+        }
+
+        if (m_backend == Backend::Register) {
+            RegisterChunk generated;
+            if (!registerChunk && RegisterGenerator::generate(chunk, generated)) registerChunk = &generated;
+            if (registerChunk) {
+                InterpretResult result = run(*registerChunk);
+                m_currentRegisterChunk = nullptr;
+                return result;
+            }
+        }
+
         return run();
     }
 
+    void VM::setCacheDirectory(const char* directory)
+    {
+        m_cache = directory ? std::make_unique<BytecodeCache>(directory) : nullptr;
+    }
+
+    bool VM::compile(const char* source, Chunk& chunk)
+    {
+        Compiler compiler;
+        if (!compiler.compile(source, chunk, m_heap)) return false;
+        Optimizer::optimize(chunk, m_optimizationLevel);
+        return true;
+    }
+
     InterpretResult VM::run()
     {
+        // Stack top lives in a local for the duration of the loop so it can stay in a register.
+        Value* stackTop = m_stackTop;
+        Value* const stackBase = m_stack.get();
+
 #define READ_BYTE() (*m_IP++)
+#define READ_LONG() (m_IP += 3, static_cast<uint32_t>(m_IP[-3] | (m_IP[-2] << 8) | (m_IP[-1] << 16)))
 #define READ_CONSTANT() (m_currentChunk->getConstant(READ_BYTE()))
-// TODO: READ_CONSTANT_LONG
+#define READ_CONSTANT_LONG() (m_currentChunk->getConstant(READ_LONG()))
+#define PUSH(value) (*stackTop++ = (value))
+#define POP() (*--stackTop)
+#define PEEK(distance) (stackTop[-1 - (distance)])
+#define DEF_GLOBAL(slot) do { \
+    size_t index = (slot); \
+    Value& global = m_globals[index]; \
+    Value value = POP(); \
+    if (global.isUndefined()) global = value; \
+    else if (!keepGlobal(index)) { \
+        runtimeError("Global variable with such name already exists."); \
+        return InterpretResult::RuntimeError; \
+    } \
+} while(false)
+#define GET_GLOBAL(slot) do { \
+    size_t index = (slot); \
+    if (m_globals[index].isUndefined()) { \
+        runtimeError("Undefined variable '%.*s'.", static_cast<int>(m_globalNames[index]->length()), m_globalNames[index]->data()); \
+        return InterpretResult::RuntimeError; \
+    } \
+    PUSH(m_globals[index]); \
+} while(false)
+#define SET_GLOBAL(slot) do { \
+    size_t index = (slot); \
+    if (m_globals[index].isUndefined()) { \
+        runtimeError("Undefined variable '%.*s'.", static_cast<int>(m_globalNames[index]->length()), m_globalNames[index]->data()); \
+        return InterpretResult::RuntimeError; \
+    } \
+    m_globals[index] = PEEK(0); \
+} while(false)
+// Instructions that see operand types their quickened form handles rewrite themselves to it, if the code
+// can be written to. size is the size of the instruction whose operands were read already.
+#define QUICKEN(quickened, size) do { \
+    if (m_quickenableCode) m_quickenableCode[m_IP - m_codeStart - (size)] = static_cast<uint8_t>(OpCode::quickened); \
+} while(false)
+// Quickened instructions check their operands before reading any, so on a mismatch the opcode is right
+// behind m_IP: it's turned back into the generic one, which is then dispatched again.
+// Quickened opcodes only ever appear in quickenable code.
+#define DEOPTIMIZE(generic) { \
+    m_quickenableCode[m_IP - m_codeStart - 1] = static_cast<uint8_t>(OpCode::generic); \
+    m_IP--; \
+    DISPATCH(); \
+}
+// Result replaces PEEK(0), which may be one of the operands.
+// TODO: Add support for concatenating Strings with Values
+#define ADD(lhs, rhs, quickened, size) do { \
+    Value addLhs = (lhs); \
+    Value addRhs = (rhs); \
+    if (addLhs.isStringOrRope() && addRhs.isStringOrRope()) { \
+        PEEK(0) = Value::makeObject(m_heap.concatenate(addLhs.asObject(), addRhs.asObject())); \
+        if (m_heap.needsCollection()) { \
+            m_stackTop = stackTop; \
+            collectGarbage(); \
+        } \
+    } else if (addLhs.isNumber() && addRhs.isNumber()) { \
+        PEEK(0) = Value::makeNumber(addLhs.asNumber() + addRhs.asNumber()); \
+        QUICKEN(quickened, size); \
+    } else { \
+        runtimeError("Operands must be two numbers or two strings."); \
+        return InterpretResult::RuntimeError; \
+    } \
+} while(false)
 #define BINARY_OP_N(op) do { \
-    if (!peek(0).isNumber() || !peek(1).isNumber()) { \
+    if (!PEEK(0).isNumber() || !PEEK(1).isNumber()) { \
         runtimeError("Operands must be numbers."); \
         return InterpretResult::RuntimeError; \
       } \
-    Value b = pop(); \
-    peek().number op= b.number; \
+    Value b = POP(); \
+    PEEK(0) = Value::makeNumber(PEEK(0).asNumber() op b.asNumber()); \
 } while(false)
 #define BINARY_OP_B(op) do { \
-    if (!peek(0).isNumber() || !peek(1).isNumber()) { \
+    if (!PEEK(0).isNumber() || !PEEK(1).isNumber()) { \
         runtimeError("Operands must be numbers."); \
         return InterpretResult::RuntimeError; \
       } \
-    Value b = pop(); \
-    push(Value::makeBool(pop().number op b.number)); \
+    Value b = POP(); \
+    PEEK(0) = Value::makeBool(PEEK(0).asNumber() op b.asNumber()); \
 } while(false)
 
-        while(true)
-        {
 #ifdef DEBUG_TRACE_EXECUTION
-            std::printf("stack: ");
-            for (auto slot : m_stack) {
-                std::printf("[");
-                printValue(slot);
-                std::printf("]");
-            }
-            std::printf("\n");
-            disassembleInstruction(*m_currentChunk, m_IP - m_currentChunk->getCodeRawPtr());
+#define TRACE_INSTRUCTION() (m_stackTop = stackTop, traceInstruction())
+#elif defined(LUX_PROFILE_OPCODES)
+#define TRACE_INSTRUCTION() (m_opcodeProfile.record(static_cast<OpCode>(*m_IP)))
+#else
+#define TRACE_INSTRUCTION() ((void)0)
 #endif
+
+#ifdef LUX_COMPUTED_GOTO
+        // Every handler jumps straight to the next one, so each opcode gets its own
+        // indirect branch (and branch predictor history) instead of sharing the switch's one.
+        static const void* s_dispatchTable[] = {
+#define LUX_OPCODE_LABEL(name, operands, stackEffect) &&op_##name,
+            LUX_OPCODES(LUX_OPCODE_LABEL)
+#undef LUX_OPCODE_LABEL
+        };
+        static_assert(sizeof(s_dispatchTable) / sizeof(s_dispatchTable[0]) == static_cast<size_t>(OpCode::Count));
+
+#define CASE(name) case OpCode::name: op_##name
+#define DISPATCH() do { TRACE_INSTRUCTION(); goto *s_dispatchTable[READ_BYTE()]; } while (false)
+#else
+#define CASE(name) case OpCode::name
+#define DISPATCH() break
+#endif
+
+        while(true)
+        {
+            TRACE_INSTRUCTION();
             OpCode opcode = (OpCode)READ_BYTE();
             switch (opcode)
             {
-            case OpCode::Constant: push(READ_CONSTANT()); break;
-            // TOOO: ConstantLong
-            case OpCode::DefGlobal: {
-                String* name = READ_CONSTANT().object->asString();
-                if (m_globals.contains(*name)) {
-                    runtimeError("Global variable with such name already exists.");
-                    return InterpretResult::RuntimeError;
-                }
-                m_globals.insert(*name, pop());
-            } break;
-            // TODO: DefGLobalLong
-            case OpCode::GetGlobal: {
-                String* name = READ_CONSTANT().object->asString();
-                auto& entry = m_globals.find(*name);
-                if (entry.key.isNull()) {
-                    runtimeError("Undefined variable '%s'.", name->cstr());
+            CASE(Constant):     PUSH(READ_CONSTANT());      DISPATCH();
+            CASE(ConstantLong): PUSH(READ_CONSTANT_LONG()); DISPATCH();
+            // Globals referenced by name are bound to a slot on first use.
+            CASE(DefGlobal):         DEF_GLOBAL(findCachedGlobal(READ_BYTE())); DISPATCH();
+            CASE(DefGlobalLong):     DEF_GLOBAL(findCachedGlobal(READ_LONG())); DISPATCH();
+            CASE(GetGlobal):         GET_GLOBAL(findCachedGlobal(READ_BYTE())); DISPATCH();
+            CASE(GetGlobalLong):     GET_GLOBAL(findCachedGlobal(READ_LONG())); DISPATCH();
+            CASE(SetGlobal):         SET_GLOBAL(findCachedGlobal(READ_BYTE())); DISPATCH();
+            CASE(SetGlobalLong):     SET_GLOBAL(findCachedGlobal(READ_LONG())); DISPATCH();
+            CASE(DefGlobalSlot):     DEF_GLOBAL(READ_BYTE()); DISPATCH();
+            CASE(DefGlobalSlotLong): DEF_GLOBAL(READ_LONG()); DISPATCH();
+            CASE(GetGlobalSlot):     GET_GLOBAL(READ_BYTE()); DISPATCH();
+            CASE(GetGlobalSlotLong): GET_GLOBAL(READ_LONG()); DISPATCH();
+            CASE(SetGlobalSlot):     SET_GLOBAL(READ_BYTE()); DISPATCH();
+            CASE(SetGlobalSlotLong): SET_GLOBAL(READ_LONG()); DISPATCH();
+            CASE(GetLocal):     PUSH(stackBase[READ_BYTE()]);    DISPATCH();
+            CASE(GetLocalLong): PUSH(stackBase[READ_LONG()]);    DISPATCH();
+            CASE(SetLocal):     stackBase[READ_BYTE()] = PEEK(0); DISPATCH();
+            CASE(SetLocalLong): stackBase[READ_LONG()] = PEEK(0); DISPATCH();
+            CASE(Nil):      PUSH(Value::makeNil());       DISPATCH();
+            CASE(True):     PUSH(Value::makeBool(true));  DISPATCH();
+            CASE(False):    PUSH(Value::makeBool(false)); DISPATCH();
+            CASE(Negate):
+                if (!PEEK(0).isNumber()) {
+                    runtimeError("Operand must be a number.");
                     return InterpretResult::RuntimeError;
                 }
-                push(entry.value);
-            } break;
-            // TODO: GetGLobalLong
-            case OpCode::SetGlobal: {
-                String* name = READ_CONSTANT().object->asString();
-                auto& entry = m_globals.find(*name);
-                if (entry.key.isNull()) {
-                    runtimeError("Undefined variable '%s'.", name->cstr());
+                PEEK(0) = Value::makeNumber(-PEEK(0).asNumber());
+                DISPATCH();
+            CASE(Add): {
+                Value b = POP();
+                ADD(PEEK(0), b, AddNumber, 1);
+            } DISPATCH();
+            CASE(Subtract): BINARY_OP_N(-); DISPATCH();
+            CASE(Multiply): BINARY_OP_N(*); DISPATCH();
+            CASE(Divide):   BINARY_OP_N(/); DISPATCH();
+            CASE(Not):
+                PEEK(0) = Value::makeBool(isFalsey(PEEK(0)));
+                DISPATCH();
+            CASE(Equal): {
+                Value b = POP();
+                if (b.isNumber() && PEEK(0).isNumber()) QUICKEN(EqualNumber, 1);
+                PEEK(0) = Value::makeBool(equals(PEEK(0), b));
+            } DISPATCH();
+            CASE(NotEqual): {
+                Value b = POP();
+                if (b.isNumber() && PEEK(0).isNumber()) QUICKEN(NotEqualNumber, 1);
+                PEEK(0) = Value::makeBool(!equals(PEEK(0), b));
+            } DISPATCH();
+            CASE(Greater):      BINARY_OP_B(>);  DISPATCH();
+            CASE(GreaterEqual): BINARY_OP_B(>=); DISPATCH();
+            CASE(Less):         BINARY_OP_B(<);  DISPATCH();
+            CASE(LessEqual):    BINARY_OP_B(<=); DISPATCH();
+            CASE(Print): print(POP()); DISPATCH();
+            CASE(Pop): stackTop--; DISPATCH();
+            CASE(PopN): stackTop -= READ_BYTE(); DISPATCH();
+            CASE(Jump): {
+                uint8_t distance = READ_BYTE();
+                m_IP += distance;
+            } DISPATCH();
+            CASE(JumpLong): {
+                uint32_t distance = READ_LONG();
+                m_IP += distance;
+            } DISPATCH();
+            CASE(JumpIfFalse): {
+                uint8_t distance = READ_BYTE();
+                if (isFalsey(PEEK(0))) m_IP += distance;
+            } DISPATCH();
+            CASE(JumpIfFalseLong): {
+                uint32_t distance = READ_LONG();
+                if (isFalsey(PEEK(0))) m_IP += distance;
+            } DISPATCH();
+            CASE(JumpIfTrue): {
+                uint8_t distance = READ_BYTE();
+                if (!isFalsey(PEEK(0))) m_IP += distance;
+            } DISPATCH();
+            CASE(JumpIfTrueLong): {
+                uint32_t distance = READ_LONG();
+                if (!isFalsey(PEEK(0))) m_IP += distance;
+            } DISPATCH();
+            CASE(Loop): {
+                uint8_t distance = READ_BYTE();
+                m_backedgeCounts[READ_BYTE()]++;
+                m_IP -= distance;
+            } DISPATCH();
+            CASE(LoopLong): {
+                uint32_t distance = READ_LONG();
+                m_backedgeCounts[READ_LONG()]++;
+                m_IP -= distance;
+            } DISPATCH();
+            CASE(Return):
+                m_stackTop = stackTop;
+                return InterpretResult::Success;
+            CASE(GetLocalPair):
+                PUSH(stackBase[m_IP[0]]);
+                PUSH(stackBase[m_IP[1]]);
+                m_IP += 2;
+                DISPATCH();
+            CASE(AddLocals):
+                PUSH(stackBase[m_IP[0]]);
+                m_IP += 2;
+                ADD(PEEK(0), stackBase[m_IP[-1]], AddLocalsNumber, 3);
+                DISPATCH();
+            CASE(AddConstant): ADD(PEEK(0), READ_CONSTANT(), AddConstantNumber, 2); DISPATCH();
+            CASE(PrintGlobalSlot): {
+                size_t index = READ_BYTE();
+                if (m_globals[index].isUndefined()) {
+                    runtimeError("Undefined variable '%.*s'.", static_cast<int>(m_globalNames[index]->length()), m_globalNames[index]->data());
                     return InterpretResult::RuntimeError;
                 }
-                entry.value = peek();
-            } break;
-            // TODO: SetGLobalLong
-            case OpCode::GetLocal: push(m_stack[READ_BYTE()]);    break;
-            case OpCode::SetLocal: m_stack[READ_BYTE()] = peek(); break;
-            case OpCode::Nil:      push(Value::makeNil());       break;
-            case OpCode::True:     push(Value::makeBool(true));  break;
-            case OpCode::False:    push(Value::makeBool(false)); break;
-            case OpCode::Negate:
-                if (!peek().isNumber()) {
+                print(m_globals[index]);
+            } DISPATCH();
+            CASE(NotLess):
+                BINARY_OP_B(<);
+                PEEK(0) = Value::makeBool(!PEEK(0).asBool());
+                DISPATCH();
+            CASE(AddNumber):
+                if (!PEEK(0).isNumber() || !PEEK(1).isNumber()) DEOPTIMIZE(Add)
+                stackTop--;
+                PEEK(0) = Value::makeNumber(PEEK(0).asNumber() + stackTop->asNumber());
+                DISPATCH();
+            CASE(AddLocalsNumber): {
+                Value lhs = stackBase[m_IP[0]];
+                Value rhs = stackBase[m_IP[1]];
+                if (!lhs.isNumber() || !rhs.isNumber()) DEOPTIMIZE(AddLocals)
+                m_IP += 2;
+                PUSH(Value::makeNumber(lhs.asNumber() + rhs.asNumber()));
+            } DISPATCH();
+            CASE(AddConstantNumber): {
+                Value constant = m_currentChunk->getConstant(m_IP[0]);
+                if (!PEEK(0).isNumber() || !constant.isNumber()) DEOPTIMIZE(AddConstant)
+                m_IP++;
+                PEEK(0) = Value::makeNumber(PEEK(0).asNumber() + constant.asNumber());
+            } DISPATCH();
+            CASE(EqualNumber):
+                if (!PEEK(0).isNumber() || !PEEK(1).isNumber()) DEOPTIMIZE(Equal)
+                stackTop--;
+                PEEK(0) = Value::makeBool(PEEK(0).asNumber() == stackTop->asNumber());
+                DISPATCH();
+            CASE(NotEqualNumber):
+                if (!PEEK(0).isNumber() || !PEEK(1).isNumber()) DEOPTIMIZE(NotEqual)
+                stackTop--;
+                PEEK(0) = Value::makeBool(PEEK(0).asNumber() != stackTop->asNumber());
+                DISPATCH();
+            case OpCode::Count: break;
+            }
+        }
+
+#undef READ_BYTE
+#undef READ_LONG
+#undef READ_CONSTANT
+#undef READ_CONSTANT_LONG
+#undef DEF_GLOBAL
+#undef GET_GLOBAL
+#undef SET_GLOBAL
+#undef PUSH
+#undef POP
+#undef PEEK
+#undef ADD
+#undef QUICKEN
+#undef DEOPTIMIZE
+#undef BINARY_OP_N
+#undef BINARY_OP_B
+#undef TRACE_INSTRUCTION
+#undef CASE
+#undef DISPATCH
+    }
+
+    InterpretResult VM::run(const RegisterChunk& chunk)
+    {
+        // Registers never need more slots than the stack code would have used, that was checked already.
+        // They are cleared to nil first, so the GC never sees values left over from earlier runs, and stay
+        // visible to it for the whole run.
+        Value* const registers = m_stack.get();
+        const Value* const constants = chunk.getConstants();
+        std::fill(registers, registers + chunk.getRegisterCount(), Value::makeNil());
+        m_stackTop = registers + chunk.getRegisterCount();
+        m_currentRegisterChunk = &chunk;
+        m_registerIP = chunk.getCode();
+        const RegisterInstruction* instruction;
+
+#define RK(operand) (((operand) & RegisterChunk::CONSTANT_BIT) ? \
+    constants[(operand) & ~RegisterChunk::CONSTANT_BIT] : registers[operand])
+#define GLOBAL(slot, mustBeDefined) do { \
+    if (m_globals[slot].isUndefined() == (mustBeDefined)) { \
+        if (mustBeDefined) \
+            runtimeError("Undefined variable '%.*s'.", static_cast<int>(m_globalNames[slot]->length()), m_globalNames[slot]->data()); \
+        else \
+            runtimeError("Global variable with such name already exists."); \
+        return InterpretResult::RuntimeError; \
+    } \
+} while (false)
+#define BINARY_OP(op, make) do { \
+    Value lhs = RK(instruction->b); \
+    Value rhs = RK(instruction->c); \
+    if (!lhs.isNumber() || !rhs.isNumber()) { \
+        runtimeError("Operands must be numbers."); \
+        return InterpretResult::RuntimeError; \
+    } \
+    registers[instruction->a] = Value::make(lhs.asNumber() op rhs.asNumber()); \
+} while (false)
+
+#ifdef DEBUG_TRACE_EXECUTION
+#define TRACE_INSTRUCTION() disassembleRegisterInstruction(chunk, m_registerIP - chunk.getCode())
+#else
+#define TRACE_INSTRUCTION() ((void)0)
+#endif
+
+#ifdef LUX_COMPUTED_GOTO
+        static const void* s_dispatchTable[] = {
+#define LUX_REGISTER_OPCODE_LABEL(name) &&op_##name,
+            LUX_REGISTER_OPCODES(LUX_REGISTER_OPCODE_LABEL)
+#undef LUX_REGISTER_OPCODE_LABEL
+        };
+        static_assert(sizeof(s_dispatchTable) / sizeof(s_dispatchTable[0]) == static_cast<size_t>(RegisterOpCode::Count));
+
+#define CASE(name) case RegisterOpCode::name: op_##name
+#define DISPATCH() do { \
+    TRACE_INSTRUCTION(); \
+    instruction = m_registerIP++; \
+    goto *s_dispatchTable[static_cast<size_t>(instruction->opcode)]; \
+} while (false)
+#else
+#define CASE(name) case RegisterOpCode::name
+#define DISPATCH() break
+#endif
+
+        while (true)
+        {
+            TRACE_INSTRUCTION();
+            instruction = m_registerIP++;
+            switch (instruction->opcode)
+            {
+            CASE(Move): registers[instruction->a] = RK(instruction->b); DISPATCH();
+            CASE(DefGlobal):
+                if (!m_globals[instruction->a].isUndefined() && keepGlobal(instruction->a)) DISPATCH();
+                GLOBAL(instruction->a, false);
+                m_globals[instruction->a] = RK(instruction->b);
+                DISPATCH();
+            CASE(GetGlobal):
+                GLOBAL(instruction->b, true);
+                registers[instruction->a] = m_globals[instruction->b];
+                DISPATCH();
+            CASE(SetGlobal):
+                GLOBAL(instruction->a, true);
+                m_globals[instruction->a] = RK(instruction->b);
+                DISPATCH();
+            CASE(Negate): {
+                Value operand = RK(instruction->b);
+                if (!operand.isNumber()) {
                     runtimeError("Operand must be a number.");
                     return InterpretResult::RuntimeError;
                 }
-                peek().number = -peek().number;
-                break;
-            case OpCode::Add:
-                // TODO: Add support for concatenating Strings with Values
-                if (peek(0).isString() && peek(1).isString()) {
-                    Value b = pop();
-                    *peek().object->asString() += *b.object->asString();
-                    //concatenate();
-                } else if (peek(0).isNumber() && peek(1).isNumber()) {
-                    Value b = pop();
-                    peek().number += b.number;
+                registers[instruction->a] = Value::makeNumber(-operand.asNumber());
+            } DISPATCH();
+            CASE(Not): registers[instruction->a] = Value::makeBool(isFalsey(RK(instruction->b))); DISPATCH();
+            CASE(Add): {
+                Value lhs = RK(instruction->b);
+                Value rhs = RK(instruction->c);
+                if (lhs.isStringOrRope() && rhs.isStringOrRope()) {
+                    registers[instruction->a] = Value::makeObject(m_heap.concatenate(lhs.asObject(), rhs.asObject()));
+                    if (m_heap.needsCollection()) collectGarbage();
+                } else if (lhs.isNumber() && rhs.isNumber()) {
+                    registers[instruction->a] = Value::makeNumber(lhs.asNumber() + rhs.asNumber());
                 } else {
-                    runtimeError( "Operands must be two numbers or two strings.");
+                    runtimeError("Operands must be two numbers or two strings.");
                     return InterpretResult::RuntimeError;
                 }
-                break;
-            case OpCode::Subtract: BINARY_OP_N(-); break;
-            case OpCode::Multiply: BINARY_OP_N(*); break;
-            case OpCode::Divide:   BINARY_OP_N(/); break;
-            case OpCode::Not:
-                peek().boolean = peek();
-                break;
-            case OpCode::Equal: {
-                Value b = pop();
-                push(Value::makeBool(pop() == b));
-            } break;
-            case OpCode::NotEqual: {
-                Value b = pop();
-                push(Value::makeBool(pop() != b));
-            } break;
-            case OpCode::Greater:      BINARY_OP_B(>);  break;
-            case OpCode::GreaterEqual: BINARY_OP_B(>=); break;
-            case OpCode::Less:         BINARY_OP_B(<);  break;
-            case OpCode::LessEqual:    BINARY_OP_B(<=); break;
-            case OpCode::Print:
-                printValue(pop());
-                std::printf("\n");
-                break;
-            case OpCode::Pop: pop(); break;
-            case OpCode::Return:
+            } DISPATCH();
+            CASE(Subtract):     BINARY_OP(-, makeNumber); DISPATCH();
+            CASE(Multiply):     BINARY_OP(*, makeNumber); DISPATCH();
+            CASE(Divide):       BINARY_OP(/, makeNumber); DISPATCH();
+            CASE(Equal):        registers[instruction->a] = Value::makeBool(equals(RK(instruction->b), RK(instruction->c))); DISPATCH();
+            CASE(NotEqual):     registers[instruction->a] = Value::makeBool(!equals(RK(instruction->b), RK(instruction->c))); DISPATCH();
+            CASE(Less):         BINARY_OP(<, makeBool);  DISPATCH();
+            CASE(LessEqual):    BINARY_OP(<=, makeBool); DISPATCH();
+            CASE(Greater):      BINARY_OP(>, makeBool);  DISPATCH();
+            CASE(GreaterEqual): BINARY_OP(>=, makeBool); DISPATCH();
+            CASE(Print): print(RK(instruction->a)); DISPATCH();
+            CASE(Jump): m_registerIP = chunk.getCode() + instruction->a; DISPATCH();
+            CASE(JumpIfFalse):
+                if (isFalsey(RK(instruction->b))) m_registerIP = chunk.getCode() + instruction->a;
+                DISPATCH();
+            CASE(JumpIfTrue):
+                if (!isFalsey(RK(instruction->b))) m_registerIP = chunk.getCode() + instruction->a;
+                DISPATCH();
+            CASE(Loop):
+                m_backedgeCounts[instruction->b]++;
+                m_registerIP = chunk.getCode() + instruction->a;
+                DISPATCH();
+            CASE(Return):
+                resetStack();
                 return InterpretResult::Success;
+            case RegisterOpCode::Count: break;
             }
         }
 
-#undef READ_BYTE
-#undef READ_CONSTANT
-#undef BINARY_OP_N
-#undef BINARY_OP_B
+#undef RK
+#undef GLOBAL
+#undef BINARY_OP
+#undef TRACE_INSTRUCTION
+#undef CASE
+#undef DISPATCH
+    }
+
+    void VM::collectGarbage()
+    {
+        m_heap.beginCollection();
+
+        for (const Value* slot = m_stack.get(); slot < m_stackTop; slot++)
+            m_heap.markValue(*slot);
+        for (Value global : m_globals)
+            m_heap.markValue(global);
+        for (String* name : m_globalNames)
+            m_heap.markObject(name);
+        for (size_t i = 0; i < m_currentChunk->getConstantCount(); i++)
+            m_heap.markValue(m_currentChunk->getConstant(i));
+
+        m_heap.sweep();
+    }
+
+    void VM::bindGlobals(const Chunk& chunk)
+    {
+        m_globalNames = chunk.getGlobalNames();
+        m_globals.assign(m_globalNames.size(), Value::makeUndefined());
+        m_keptGlobals.clear();
+        m_globalSlots.clear();
+        for (size_t slot = 0; slot < m_globalNames.size(); slot++)
+            m_globalSlots.insert(m_globalNames[slot], Value::makeNumber(static_cast<double>(slot)));
+    }
+
+    bool VM::keepGlobal(size_t slot)
+    {
+        if (slot >= m_keptGlobals.size() || !m_keptGlobals[slot]) return false;
+        // Only the first definition is the rerun's, another one in the same run is still an error.
+        m_keptGlobals[slot] = false;
+        return true;
+    }
+
+    inline size_t VM::findCachedGlobal(size_t nameConstant)
+    {
+        if (nameConstant >= m_globalCaches.size()) m_globalCaches.resize(m_currentChunk->getConstantCount());
+        GlobalCache& cache = m_globalCaches[nameConstant];
+        if (cache.version == m_globalSlots.getVersion()) return cache.slot;
+
+        m_globalCacheMisses++;
+        size_t slot = findOrAddGlobal(m_currentChunk->getConstant(nameConstant).asObject()->asString());
+        // Adding the name may have rehashed the table, so the version is read after it.
+        cache = { m_globalSlots.getVersion(), static_cast<uint32_t>(slot) };
+        return slot;
+    }
+
+    size_t VM::findOrAddGlobal(String* name)
+    {
+        const HashTable::Entry* entry = m_globalSlots.find(name);
+        if (entry) return static_cast<size_t>(entry->value.asNumber());
+
+        // Global the compiler didn't know about, it stays undefined until something defines it.
+        size_t slot = m_globals.size();
+        m_globals.emplace_back(Value::makeUndefined());
+        m_globalNames.emplace_back(name);
+        m_globalSlots.insert(name, Value::makeNumber(static_cast<double>(slot)));
+        return slot;
+    }
+
+    bool VM::equals(Value lhs, Value rhs)
+    {
+        if (lhs == rhs) return true;
+        if (!lhs.isStringOrRope() || !rhs.isStringOrRope()) return false;
+        if (Rope::lengthOf(lhs.asObject()) != Rope::lengthOf(rhs.asObject())) return false;
+
+        // Interned strings are equal only if they are the same object, others are compared by contents.
+        // Their hashes are cached, so comparing the same strings again rejects most of them quickly.
+        const String* lhsString = m_heap.flatten(lhs.asObject());
+        const String* rhsString = m_heap.flatten(rhs.asObject());
+        if (lhsString == rhsString) return true;
+        if (lhsString->isInterned() && rhsString->isInterned()) return false;
+        return lhsString->hash() == rhsString->hash() &&
+               std::memcmp(lhsString->data(), rhsString->data(), lhsString->length()) == 0;
     }
 
     bool VM::isFalsey(Value value)
     {
-        return value.isNil() || (value.isBool() && !value.boolean);
+        return value.isNil() || (value.isBool() && !value.asBool());
     }
 
-    void VM::runtimeError(const char *format, ...)
+#ifdef DEBUG_TRACE_EXECUTION
+    void VM::traceInstruction() const
     {
-        va_list args;
-        va_start(args, format);
-        std::vprintf(format, args);
-        va_end(args);
-        std::puts("\n");
+        std::printf("stack: ");
+        for (const Value* slot = m_stack.get(); slot < m_stackTop; slot++) {
+            std::printf("[");
+            printValue(*slot);
+            std::printf("]");
+        }
+        std::printf("\n");
+        disassembleInstruction(*m_currentChunk, m_IP - m_codeStart);
+    }
+#endif
 
-        size_t instruction = m_IP - m_currentChunk->getCodeRawPtr() - 1;
-        size_t line = m_currentChunk->getLine(instruction);
-        std::printf("[line %zu] in script\n", line);
-        m_stack.clear(); // TODO: implement proper stack
+#ifdef LUX_PROFILE_OPCODES
+    void VM::OpcodeProfile::record(OpCode opcode)
+    {
+        if (previous != OpCode::Count)
+            pairCounts[static_cast<size_t>(previous) * OPCODE_COUNT + static_cast<size_t>(opcode)]++;
+        // Nothing follows Return, next run starts a new sequence.
+        previous = opcode == OpCode::Return ? OpCode::Count : opcode;
     }
 
-    void VM::push(Value value)
+    void VM::printOpcodeProfile(std::FILE* file, size_t maxPairs) const
     {
-        m_stack.push_back(value);
+        uint64_t total = 0;
+        std::vector<size_t> pairs;
+        for (size_t i = 0; i < m_opcodeProfile.pairCounts.size(); i++) {
+            total += m_opcodeProfile.pairCounts[i];
+            if (m_opcodeProfile.pairCounts[i] > 0) pairs.emplace_back(i);
+        }
+        std::sort(pairs.begin(), pairs.end(), [this](size_t lhs, size_t rhs) {
+            return m_opcodeProfile.pairCounts[lhs] > m_opcodeProfile.pairCounts[rhs];
+        });
+        if (pairs.size() > maxPairs) pairs.resize(maxPairs);
+
+        std::fprintf(file, "== opcode pairs (%llu) ==\n", static_cast<unsigned long long>(total));
+        for (size_t pair : pairs) {
+            uint64_t count = m_opcodeProfile.pairCounts[pair];
+            std::fprintf(file, "%-16s %-16s %12llu %6.2f%%\n",
+                getOpCodeName(static_cast<OpCode>(pair / OpcodeProfile::OPCODE_COUNT)),
+                getOpCodeName(static_cast<OpCode>(pair % OpcodeProfile::OPCODE_COUNT)),
+                static_cast<unsigned long long>(count), 100.0 * count / total);
+        }
     }
+#endif
 
-    Value VM::pop()
+    void VM::print(Value value)
     {
-        Value val = *(m_stack.end() - 1);
-        m_stack.pop_back();
-        return val;
+        if (m_output) {
+            printValue(value, *m_output);
+            *m_output += '\n';
+        }
+        else {
+            printValue(value);
+            std::printf("\n");
+        }
     }
 
-    Value &VM::peek(size_t distance)
+    void VM::write(const char* format, ...)
     {
-        return *(m_stack.end() - 1 - distance);
+        va_list args;
+        va_start(args, format);
+        writeV(format, args);
+        va_end(args);
+    }
+
+    void VM::writeV(const char* format, va_list args)
+    {
+        if (!m_output) {
+            std::vprintf(format, args);
+            return;
+        }
+
+        va_list argsCopy;
+        va_copy(argsCopy, args);
+        int length = std::vsnprintf(nullptr, 0, format, argsCopy);
+        va_end(argsCopy);
+        if (length <= 0) return;
+
+        size_t size = m_output->size();
+        m_output->resize(size + length + 1);
+        std::vsnprintf(m_output->data() + size, length + 1, format, args);
+        m_output->resize(size + length);
+    }
+
+    void VM::runtimeError(const char *format, ...)
+    {
+        va_list args;
+        va_start(args, format);
+        writeV(format, args);
+        va_end(args);
+        write("\n\n");
+
+        size_t line;
+        if (m_currentRegisterChunk)
+            line = m_currentRegisterChunk->getLine(m_registerIP - m_currentRegisterChunk->getCode() - 1);
+        else
+            line = m_currentChunk->getLine(m_IP - m_codeStart - 1);
+        write("[line %zu] in script\n", line);
+        resetStack();
     }
 
 } // namespace Lux
@@ -1,40 +1,157 @@
 #pragma once
 #include "common.hpp"
+#include "chunk.hpp"
+#include "bytecode_cache.hpp"
+#include "heap.hpp"
+#include "program.hpp"
+#include "register_chunk.hpp"
 #include "types/value.hpp"
 #include "types/hash_table.hpp"
 
 #include <cstdarg>
+#include <memory>
+#include <string>
 #include <vector>
 
 namespace Lux {
 
-    class Chunk;
-
     enum class InterpretResult {
         Success,
         CompilationError,
         RuntimeError
     };
 
+    enum class Backend {
+        Stack,
+        Register // Falls back to the stack VM for chunks the RegisterGenerator doesn't support.
+    };
+
+    enum class Globals {
+        Fresh,      // every global is undefined when the program starts
+        // Globals keep values from the previous run if it ran the same program. The first definition of
+        // such a global keeps its value, defining it again in the same run fails like in any other run.
+        Persistent
+    };
+
     class VM
     {
     public:
+        static constexpr size_t DEFAULT_STACK_CAPACITY = 1024;
+
+        explicit VM(size_t stackCapacity = DEFAULT_STACK_CAPACITY, Heap::Config heapConfig = {});
+
         InterpretResult interpret(const char *source);
+        // Runs a chunk compiled (or loaded) with this VM's heap.
+        InterpretResult interpret(const Chunk& chunk);
+        // Runs a compiled program, globals are reset in place without reallocating them.
+        InterpretResult run(const Program& program, Globals globals = Globals::Fresh);
+        // Compiles and optimizes source without running it.
+        bool compile(const char* source, Chunk& chunk);
+
+        Heap& getHeap() { return m_heap; }
+        const Heap& getHeap() const { return m_heap; }
+        // See Optimizer for what each level does.
+        void setOptimizationLevel(int level) { m_optimizationLevel = level; }
+        void setBackend(Backend backend) { m_backend = backend; }
+        // Output of print statements and runtime errors is appended to output instead of going to stdout,
+        // nullptr restores stdout.
+        void setOutput(std::string* output) { m_output = output; }
+        // Makes interpret(source) reuse chunks compiled by earlier runs, nullptr disables the cache.
+        void setCacheDirectory(const char* directory);
+        // How many times each loop of the last run jumped back to its start, indexed by loop number
+        // (loops are numbered in the order they appear in the source, see Chunk::addLoop).
+        // Loops that run often are the ones worth compiling further.
+        const std::vector<uint64_t>& getBackedgeCounts() const { return m_backedgeCounts; }
+        // How many lookups of globals by name in the last run had to search the table instead of using
+        // the cached slot. Always 0 for compiled code, it never accesses globals by name.
+        size_t getGlobalCacheMisses() const { return m_globalCacheMisses; }
+        // This VM's copy of the code of the last program it ran, with the instructions quickened so far.
+        const std::vector<uint8_t>& getProgramCode() const { return m_programCode; }
+#ifdef LUX_PROFILE_OPCODES
+        // Prints how often each pair of opcodes was executed back to back, most frequent first.
+        // Frequent pairs are the candidates for superinstructions (see Optimizer).
+        void printOpcodeProfile(std::FILE* file, size_t maxPairs = 20) const;
+#endif
     private:
+        // quickenableCode is the chunk's code or a copy of it the VM may quicken, nullptr runs the chunk's code as is.
+        InterpretResult interpret(const Chunk& chunk, uint8_t* quickenableCode);
+        InterpretResult execute(const Chunk& chunk, const RegisterChunk* registerChunk, uint8_t* quickenableCode);
         InterpretResult run();
+        InterpretResult run(const RegisterChunk& chunk);
 
+        bool equals(Value lhs, Value rhs);
         static bool isFalsey(Value value);
 
+        void collectGarbage();
+
+        void bindGlobals(const Chunk& chunk);
+        // Slot of the global named by a string constant of the current chunk.
+        size_t findCachedGlobal(size_t nameConstant);
+        size_t findOrAddGlobal(String* name);
+        // Whether defining a global that has a value keeps it instead of failing, see Globals::Persistent.
+        bool keepGlobal(size_t slot);
+
+        void print(Value value);
+        void write(const char* format, ...);
+        void writeV(const char* format, va_list args);
         void runtimeError(const char* format, ...);
-        
-        void push(Value value);
-        Value pop();
-        Value& peek(size_t distance = 0);
+        void resetStack() { m_stackTop = m_stack.get(); }
+#ifdef DEBUG_TRACE_EXECUTION
+        void traceInstruction() const;
+#endif
+
+#ifdef LUX_PROFILE_OPCODES
+        struct OpcodeProfile {
+            static constexpr size_t OPCODE_COUNT = static_cast<size_t>(OpCode::Count);
+
+            void record(OpCode opcode);
+
+            OpCode previous = OpCode::Count;
+            std::vector<uint64_t> pairCounts = std::vector<uint64_t>(OPCODE_COUNT * OPCODE_COUNT);
+        };
+        OpcodeProfile m_opcodeProfile;
+#endif
 
+        int m_optimizationLevel = 0;
+        Backend m_backend = Backend::Stack;
+        std::unique_ptr<BytecodeCache> m_cache;
+        std::string* m_output = nullptr;
         const Chunk *m_currentChunk = nullptr;
-        const uint8_t *m_IP;
-        std::vector<Value> m_stack;
-        HashTable m_globals;
+        // Copy of the last program's code, quickened instructions are written to it.
+        std::vector<uint8_t> m_programCode;
+        uint64_t m_programCodeId = 0;
+        const uint8_t* m_codeStart;
+        uint8_t* m_quickenableCode = nullptr; // Same code as m_codeStart, nullptr if it's read-only
+        const uint8_t* m_IP;
+        // Counted per VM and not in the chunk, so chunks stay read-only.
+        std::vector<uint64_t> m_backedgeCounts;
+        // Set while register code runs, m_currentChunk still points to the chunk it was generated from.
+        const RegisterChunk* m_currentRegisterChunk = nullptr;
+        const RegisterInstruction* m_registerIP;
+        // Chunks are checked against the capacity before they run,
+        // so pushing never has to test for overflow.
+        size_t m_stackCapacity;
+        std::unique_ptr<Value[]> m_stack;
+        Value* m_stackTop;
+        Heap m_heap;
+        // Globals live in a flat array indexed by the slots the compiler assigned,
+        // slots that hold Value::makeUndefined() were not defined yet.
+        std::vector<Value> m_globals;
+        std::vector<String*> m_globalNames;
+        HashTable m_globalSlots; // name -> slot, for globals accessed by name
+        std::vector<bool> m_keptGlobals; // slots a Persistent rerun didn't define again yet
+        // Slots found for the name constants of the current chunk, valid while their version matches
+        // m_globalSlots' version. Only hand-built chunks (and bytecode saved from them) access globals by
+        // name, compiled code addresses them by slot. So this only keeps such chunks from searching the
+        // table on every access, and it is dropped after each run. It is kept by the VM and not by the chunk, so chunks stay
+        // read-only and can be shared by VMs that bound the names to different slots.
+        struct GlobalCache {
+            uint32_t version = 0;
+            uint32_t slot = 0;
+        };
+        std::vector<GlobalCache> m_globalCaches;
+        size_t m_globalCacheMisses = 0;
+        uint64_t m_boundProgramId = 0; // Program the globals belong to, 0 if they belong to a plain chunk
     };
 
 } // namespace Lux
@@ -0,0 +1,46 @@
+#include "batch_runner.hpp"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+
+TEST(BatchRunnerTests, givenSharedProgramsWhenRunningManyJobsOnSeveralThreadsThenResultsAreInSubmissionOrder)
+{
+    std::shared_ptr<const Lux::Program> greet = Lux::Program::compile(R"(
+var name = "lux";
+var greeting = "hello " + name;
+print greeting;
+)");
+    std::shared_ptr<const Lux::Program> fail = Lux::Program::compile("var a = 1;\nprint a + \"b\";");
+    ASSERT_NE(greet, nullptr);
+    ASSERT_NE(fail, nullptr);
+
+    for (Lux::Backend backend : { Lux::Backend::Stack, Lux::Backend::Register }) {
+        Lux::BatchRunner runner{ 4, backend };
+        EXPECT_EQ(runner.getThreadCount(), 4u);
+
+        constexpr size_t JOB_COUNT = 200;
+        for (size_t i = 0; i < JOB_COUNT; i++)
+            runner.submit(i % 10 == 3 ? fail : greet);
+
+        std::vector<Lux::BatchRunner::Result> results = runner.wait();
+        ASSERT_EQ(results.size(), JOB_COUNT);
+        for (size_t i = 0; i < JOB_COUNT; i++) {
+            if (i % 10 == 3) {
+                EXPECT_EQ(results[i].result, Lux::InterpretResult::RuntimeError);
+                EXPECT_EQ(results[i].output, "Operands must be two numbers or two strings.\n\n[line 2] in script\n");
+            }
+            else {
+                EXPECT_EQ(results[i].result, Lux::InterpretResult::Success);
+                EXPECT_EQ(results[i].output, "hello lux\n");
+            }
+        }
+
+        // The runner can be reused after wait.
+        runner.submit(greet);
+        results = runner.wait();
+        ASSERT_EQ(results.size(), 1u);
+        EXPECT_EQ(results[0].output, "hello lux\n");
+    }
+}
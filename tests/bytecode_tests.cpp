@@ -0,0 +1,222 @@
+#include "bytecode.hpp"
+#include "chunk.hpp"
+#include "compiler.hpp"
+#include "heap.hpp"
+#include "mapped_file.hpp"
+#include "optimizer.hpp"
+#include "vm.hpp"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+static std::string interpretAndCaptureOutput(Lux::VM& vm, const Lux::Chunk& chunk)
+{
+    testing::internal::CaptureStdout();
+    vm.interpret(chunk);
+    std::fflush(stdout);
+    return testing::internal::GetCapturedStdout();
+}
+
+TEST(BytecodeTests, givenSerializedChunkWhenLoadingMappedFileInAnotherVMThenItRunsFromTheMapping)
+{
+    const char* source = R"(
+var greeting = "Hello";
+{
+    var a = 1.5;
+    print greeting + " World!";
+    print a * 2 == 3;
+    print nil;
+}
+print -greeting;
+)";
+    Lux::VM compilingVM;
+    compilingVM.setOptimizationLevel(Lux::Optimizer::MAX_LEVEL);
+    Lux::Chunk chunk;
+    ASSERT_TRUE(compilingVM.compile(source, chunk));
+    std::string expected = interpretAndCaptureOutput(compilingVM, chunk);
+
+    std::string path = testing::TempDir() + "bytecode_tests.luxb";
+    std::vector<uint8_t> data = Lux::Bytecode::serialize(chunk);
+    std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(data.data()), data.size());
+
+    Lux::MappedFile file{ path.c_str() };
+    ASSERT_TRUE(file.isOpen());
+    ASSERT_TRUE(Lux::Bytecode::isBytecode(file.getData(), file.getSize()));
+
+    Lux::VM vm;
+    Lux::Chunk loaded;
+    ASSERT_TRUE(Lux::Bytecode::deserialize(file.getData(), file.getSize(), loaded, vm.getHeap()));
+    EXPECT_GE(loaded.getCodeRawPtr(), file.getData());
+    EXPECT_LT(loaded.getCodeRawPtr(), file.getData() + file.getSize());
+    EXPECT_EQ(interpretAndCaptureOutput(vm, loaded), expected);
+    EXPECT_EQ(expected, "Hello World!\ntrue\nnil\nOperand must be a number.\n\n[line 9] in script\n");
+    // The mapping is run as is, nothing in it is quickened.
+    EXPECT_TRUE(std::equal(data.begin(), data.end(), file.getData()));
+
+    std::remove(path.c_str());
+}
+
+TEST(BytecodeTests, givenMalformedDataWhenDeserializingThenItIsRejected)
+{
+    Lux::VM vm;
+    Lux::Chunk chunk;
+    ASSERT_TRUE(vm.compile("print 1 + 2;", chunk));
+    const std::vector<uint8_t> data = Lux::Bytecode::serialize(chunk);
+    Lux::Chunk loaded;
+    ASSERT_TRUE(Lux::Bytecode::deserialize(data.data(), data.size(), loaded, vm.getHeap()));
+
+    for (size_t size = 0; size < data.size(); size++)
+        EXPECT_FALSE(Lux::Bytecode::deserialize(data.data(), size, loaded, vm.getHeap())) << size;
+
+    std::vector<uint8_t> wrongVersion = data;
+    wrongVersion[4]++;
+    EXPECT_FALSE(Lux::Bytecode::deserialize(wrongVersion.data(), wrongVersion.size(), loaded, vm.getHeap()));
+
+    // Constant; DefGlobalSlot; GetGlobalSlot; GetGlobalSlot; Add; Print; Return
+    Lux::Chunk numbers;
+    ASSERT_TRUE(vm.compile("var a = 1; print a + a;", numbers));
+    std::vector<uint8_t> quickened = Lux::Bytecode::serialize(numbers);
+    ASSERT_EQ(quickened[Lux::Bytecode::HEADER_SIZE + 8], static_cast<uint8_t>(Lux::OpCode::Add));
+    quickened[Lux::Bytecode::HEADER_SIZE + 8] = static_cast<uint8_t>(Lux::OpCode::AddNumber);
+    EXPECT_FALSE(Lux::Bytecode::deserialize(quickened.data(), quickened.size(), loaded, vm.getHeap()));
+
+    std::vector<uint8_t> trailingData = data;
+    trailingData.emplace_back(0);
+    EXPECT_FALSE(Lux::Bytecode::deserialize(trailingData.data(), trailingData.size(), loaded, vm.getHeap()));
+}
+
+TEST(BytecodeTests, givenCacheDirectoryWhenInterpretingSameSourceAgainThenCachedChunkIsUsed)
+{
+    namespace fs = std::filesystem;
+    fs::path directory = fs::path{ testing::TempDir() } / "bytecode_tests_cache";
+    fs::remove_all(directory);
+    const char* source = "print 1 + 2;";
+
+    {
+        Lux::VM vm;
+        vm.setCacheDirectory(directory.string().c_str());
+        testing::internal::CaptureStdout();
+        EXPECT_EQ(vm.interpret(source), Lux::InterpretResult::Success);
+        EXPECT_EQ(testing::internal::GetCapturedStdout(), "3\n");
+    }
+    ASSERT_EQ(std::distance(fs::directory_iterator{ directory }, fs::directory_iterator{}), 1);
+    fs::path cachedPath = fs::directory_iterator{ directory }->path();
+    // Chunks of another code generator are never served.
+    const std::string codegen = "-c" + std::to_string(Lux::Compiler::CODEGEN_VERSION) + "-";
+    EXPECT_NE(cachedPath.filename().string().find(codegen), std::string::npos);
+
+    // Replace the cached chunk with another one to see it's really what runs.
+    {
+        Lux::VM vm;
+        Lux::Chunk chunk;
+        ASSERT_TRUE(vm.compile("print \"cached\";", chunk));
+        std::vector<uint8_t> data = Lux::Bytecode::serialize(chunk);
+        std::ofstream(cachedPath, std::ios::binary).write(reinterpret_cast<const char*>(data.data()), data.size());
+    }
+    {
+        Lux::VM vm;
+        vm.setCacheDirectory(directory.string().c_str());
+        testing::internal::CaptureStdout();
+        EXPECT_EQ(vm.interpret(source), Lux::InterpretResult::Success);
+        EXPECT_EQ(testing::internal::GetCapturedStdout(), "cached\n");
+
+        // Different optimization level is a different entry.
+        vm.setOptimizationLevel(1);
+        testing::internal::CaptureStdout();
+        EXPECT_EQ(vm.interpret(source), Lux::InterpretResult::Success);
+        EXPECT_EQ(testing::internal::GetCapturedStdout(), "3\n");
+    }
+    EXPECT_EQ(std::distance(fs::directory_iterator{ directory }, fs::directory_iterator{}), 2);
+
+    fs::remove_all(directory);
+}
+
+TEST(BytecodeTests, givenJumpOutsideOfCodeOrUnknownLoopWhenDeserializingThenItIsRejected)
+{
+    Lux::VM vm;
+    Lux::Chunk chunk;
+    ASSERT_TRUE(vm.compile("while (false) print 1;", chunk));
+    const std::vector<uint8_t> data = Lux::Bytecode::serialize(chunk);
+    Lux::Chunk loaded;
+    ASSERT_TRUE(Lux::Bytecode::deserialize(data.data(), data.size(), loaded, vm.getHeap()));
+    EXPECT_EQ(loaded.getLoopCount(), 1u);
+
+    // False; JumpIfFalseLong; Pop; Constant; Print; Loop distance loop; Pop; Return
+    constexpr size_t loopOffset = Lux::Bytecode::HEADER_SIZE + 9;
+    ASSERT_EQ(data[loopOffset], static_cast<uint8_t>(Lux::OpCode::Loop));
+
+    std::vector<uint8_t> jumpBeforeCode = data;
+    jumpBeforeCode[loopOffset + 1]++;
+    EXPECT_FALSE(Lux::Bytecode::deserialize(jumpBeforeCode.data(), jumpBeforeCode.size(), loaded, vm.getHeap()));
+
+    std::vector<uint8_t> jumpIntoInstruction = data;
+    jumpIntoInstruction[loopOffset + 1] -= 2;
+    EXPECT_FALSE(Lux::Bytecode::deserialize(jumpIntoInstruction.data(), jumpIntoInstruction.size(), loaded, vm.getHeap()));
+
+    std::vector<uint8_t> unknownLoop = data;
+    unknownLoop[loopOffset + 2]++;
+    EXPECT_FALSE(Lux::Bytecode::deserialize(unknownLoop.data(), unknownLoop.size(), loaded, vm.getHeap()));
+}
+
+// Whether the serialized chunk still loads with its code byte at offset replaced.
+static bool loadsWithCodeByte(const Lux::Chunk& chunk, size_t offset, uint8_t byte)
+{
+    std::vector<uint8_t> data = Lux::Bytecode::serialize(chunk);
+    data[Lux::Bytecode::HEADER_SIZE + offset] = byte;
+    Lux::Heap heap;
+    Lux::Chunk loaded;
+    return Lux::Bytecode::deserialize(data.data(), data.size(), loaded, heap);
+}
+
+TEST(BytecodeTests, givenConstantIndexOutOfRangeWhenDeserializingThenItIsRejected)
+{
+    Lux::VM vm;
+    Lux::Chunk chunk;
+    ASSERT_TRUE(vm.compile("print 1;", chunk));
+    // Constant 0; Print; Return
+    ASSERT_EQ(chunk.getByte(0), static_cast<uint8_t>(Lux::OpCode::Constant));
+    EXPECT_TRUE(loadsWithCodeByte(chunk, 1, 0));
+    EXPECT_FALSE(loadsWithCodeByte(chunk, 1, 1));
+}
+
+TEST(BytecodeTests, givenGlobalNameThatIsNotAStringConstantWhenDeserializingThenItIsRejected)
+{
+    Lux::VM vm;
+    Lux::Chunk chunk;
+    // GetGlobal 0; Print; Return, with a number as the second constant.
+    chunk.writeConstant(Lux::Value::makeObject(vm.getHeap().makeString("a", 1)), 1, Lux::OpCode::GetGlobal, Lux::OpCode::GetGlobalLong);
+    chunk.write(static_cast<uint8_t>(Lux::OpCode::Print), 1);
+    chunk.write(static_cast<uint8_t>(Lux::OpCode::Return), 1);
+    chunk.addConstant(Lux::Value::makeNumber(2));
+    EXPECT_TRUE(loadsWithCodeByte(chunk, 1, 0));
+    EXPECT_FALSE(loadsWithCodeByte(chunk, 1, 1));
+    EXPECT_FALSE(loadsWithCodeByte(chunk, 1, 2));
+}
+
+TEST(BytecodeTests, givenGlobalSlotOutOfRangeWhenDeserializingThenItIsRejected)
+{
+    Lux::VM vm;
+    Lux::Chunk chunk;
+    ASSERT_TRUE(vm.compile("var a = 1; print a;", chunk));
+    // Constant 0; DefGlobalSlot 0; GetGlobalSlot 0; Print; Return
+    ASSERT_EQ(chunk.getByte(4), static_cast<uint8_t>(Lux::OpCode::GetGlobalSlot));
+    EXPECT_TRUE(loadsWithCodeByte(chunk, 5, 0));
+    EXPECT_FALSE(loadsWithCodeByte(chunk, 5, 1));
+}
+
+TEST(BytecodeTests, givenLocalAboveStackTopWhenDeserializingThenItIsRejected)
+{
+    Lux::VM vm;
+    Lux::Chunk chunk;
+    ASSERT_TRUE(vm.compile("{ var a = 1; print a; }", chunk));
+    // Constant 0; GetLocal 0; Print; Pop; Return
+    ASSERT_EQ(chunk.getByte(2), static_cast<uint8_t>(Lux::OpCode::GetLocal));
+    EXPECT_TRUE(loadsWithCodeByte(chunk, 3, 0));
+    EXPECT_FALSE(loadsWithCodeByte(chunk, 3, 1));
+}
@@ -0,0 +1,121 @@
+#include "chunk.hpp"
+#include "compiler.hpp"
+#include "heap.hpp"
+#include "program.hpp"
+#include "vm.hpp"
+#include "types/string.hpp"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+TEST(CompilerTests, givenConstantExpressionsWhenCompilingThenTheyAreFolded)
+{
+    const char* source = R"(
+{
+    var a = 60 * 60 * 24;
+    print -(-a * 1) - 0;
+    print !!(a > 1);
+    print "a" + "b" == "ab";
+}
+)";
+    Lux::Compiler compiler;
+    Lux::Chunk chunk;
+    Lux::Heap heap;
+    ASSERT_TRUE(compiler.compile(source, chunk, heap));
+
+    using Lux::OpCode;
+    std::vector<uint8_t> expected = {
+        (uint8_t)OpCode::Constant, 3,
+        (uint8_t)OpCode::GetLocal, 0,
+        (uint8_t)OpCode::Negate,
+        (uint8_t)OpCode::Negate,
+        (uint8_t)OpCode::Print,
+        (uint8_t)OpCode::GetLocal, 0,
+        (uint8_t)OpCode::Constant, 4,
+        (uint8_t)OpCode::Greater,
+        (uint8_t)OpCode::Print,
+        (uint8_t)OpCode::True,
+        (uint8_t)OpCode::Print,
+        (uint8_t)OpCode::Pop,
+        (uint8_t)OpCode::Return
+    };
+    std::vector<uint8_t> code(chunk.getCodeRawPtr(), chunk.getCodeRawPtr() + chunk.getCodeSize());
+    EXPECT_EQ(code, expected);
+    EXPECT_EQ(chunk.getConstant(3).asNumber(), 86400.0);
+    EXPECT_EQ(chunk.getLine(chunk.getCodeSize() - 4), 6u);
+}
+
+TEST(CompilerTests, givenIllTypedConstantOperandsWhenInterpretingThenRuntimeErrorIsStillReported)
+{
+    const char* sources[] = {
+        "print -\"a\";",
+        "print 1 + \"a\";",
+        "print \"a\" < \"b\";",
+    };
+    for (const char* source : sources) {
+        Lux::VM vm;
+        testing::internal::CaptureStdout();
+        EXPECT_EQ(vm.interpret(source), Lux::InterpretResult::RuntimeError) << source;
+        std::fflush(stdout);
+        testing::internal::GetCapturedStdout();
+    }
+}
+
+TEST(CompilerTests, givenProgramWhenCompilingThenItsStringsAreSlicesOfItsSourceAndOtherSourcesAreCopied)
+{
+    const char* source = "var greeting = \"hello\";\nprint greeting + \"hello\";\nprint \"world\";\n";
+    std::unique_ptr<Lux::Program> program = Lux::Program::compile(source);
+    ASSERT_NE(program, nullptr);
+    const Lux::String* text = program->getSource();
+    ASSERT_NE(text, nullptr);
+    EXPECT_STREQ(text->data(), source);
+
+    auto strings = [](const Lux::Chunk& chunk) {
+        std::vector<const Lux::String*> strings(chunk.getGlobalNames().begin(), chunk.getGlobalNames().end());
+        for (size_t i = 0; i < chunk.getConstantCount(); i++) {
+            Lux::Value constant = chunk.getConstant(i);
+            if (constant.isString()) strings.push_back(constant.asObject()->asString());
+        }
+        return strings;
+    };
+
+    std::vector<const Lux::String*> sliced = strings(program->getChunk());
+    EXPECT_EQ(sliced.size(), 3u);
+    for (const Lux::String* string : sliced) {
+        EXPECT_TRUE(string->isSlice());
+        EXPECT_EQ(string->getParent(), text);
+    }
+
+    // Sources that aren't kept as heap strings have their strings copied, interned ones are reused either way.
+    Lux::Compiler compiler;
+    Lux::Heap heap;
+    Lux::Chunk chunk;
+    ASSERT_TRUE(compiler.compile(source, chunk, heap));
+    std::vector<const Lux::String*> copied = strings(chunk);
+    EXPECT_EQ(copied.size(), 3u);
+    for (const Lux::String* string : copied) EXPECT_FALSE(string->isSlice());
+    Lux::Chunk second;
+    ASSERT_TRUE(compiler.compile("print \"world\";", second, heap));
+    EXPECT_EQ(second.getConstant(0).asObject()->asString(), copied.back());
+}
+
+TEST(CompilerTests, givenNestedExpressionsAndBranchesWhenCompilingThenMaxStackDepthIsComputedOnce)
+{
+    const char* source = R"(
+var a = 1;
+print a + (a + (a + a));
+if (a) { var b = a; print b; } else print a;
+)";
+    Lux::Compiler compiler;
+    Lux::Chunk chunk;
+    Lux::Heap heap;
+    ASSERT_TRUE(compiler.compile(source, chunk, heap));
+
+    // Constant; DefGlobalSlot; GetGlobalSlot x4 - the fourth one is the deepest point.
+    EXPECT_EQ(chunk.getMaxStackDepth(), 4u);
+    EXPECT_EQ(chunk.getMaxStackDepthOffset(), 10u);
+    EXPECT_EQ(static_cast<Lux::OpCode>(chunk.getByte(10)), Lux::OpCode::GetGlobalSlot);
+}
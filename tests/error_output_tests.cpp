@@ -1,5 +1,6 @@
 #include "compiler.hpp"
 #include "chunk.hpp"
+#include "heap.hpp"
 
 #include <gtest/gtest.h>
 
@@ -12,10 +13,11 @@ print value;
 )";
     Lux::Compiler compiler;
     Lux::Chunk chunk;
+    Lux::Heap heap;
 
     testing::internal::CaptureStderr();
 
-    bool result = compiler.compile(source, chunk);
+    bool result = compiler.compile(source, chunk, heap);
     EXPECT_EQ(result, false);
 
     std::string output = testing::internal::GetCapturedStderr();
@@ -0,0 +1,50 @@
+#include "heap.hpp"
+#include "types/hash_table.hpp"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+TEST(HashTableTests, givenManyKeysWhenInsertingRemovingAndReinsertingThenEveryLookupFindsTheRightEntry)
+{
+    Lux::Heap heap;
+    std::vector<Lux::String*> keys;
+    for (int i = 0; i < 100000; i++) {
+        std::string name = "key" + std::to_string(i);
+        keys.push_back(heap.makeString(name.c_str(), name.size()));
+    }
+
+    Lux::HashTable table;
+    for (size_t i = 0; i < keys.size(); i++)
+        table.insert(keys[i], Lux::Value::makeNumber(static_cast<double>(i)));
+    EXPECT_EQ(table.size(), keys.size());
+
+    // Removing leaves tombstones that inserting has to reuse or rehash away.
+    for (int round = 0; round < 3; round++) {
+        for (size_t i = 0; i < keys.size(); i += 2)
+            EXPECT_TRUE(table.remove(keys[i]));
+        EXPECT_FALSE(table.remove(keys[0]));
+        EXPECT_EQ(table.size(), keys.size() / 2);
+
+        for (size_t i = 0; i < keys.size(); i++) {
+            const Lux::HashTable::Entry* entry = table.find(keys[i]);
+            if (i % 2 == 0) {
+                EXPECT_EQ(entry, nullptr);
+                table.insert(keys[i], Lux::Value::makeNumber(static_cast<double>(i + round)));
+            }
+            else {
+                ASSERT_NE(entry, nullptr);
+                EXPECT_EQ(entry->key, keys[i]);
+                EXPECT_EQ(entry->hash, keys[i]->hash());
+                EXPECT_EQ(entry->value.asNumber(), static_cast<double>(i));
+            }
+        }
+        EXPECT_EQ(table.size(), keys.size());
+    }
+
+    EXPECT_EQ(table.find(keys[42])->value.asNumber(), 44.0);
+    EXPECT_EQ(table.findString("key777", 6, keys[777]->hash()), keys[777]);
+    EXPECT_EQ(table.findString("key778", 6, keys[778]->hash()), keys[778]);
+    EXPECT_EQ(table.findString("missing", 7, Lux::hashString("missing", 7)), nullptr);
+}
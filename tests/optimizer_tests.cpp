@@ -0,0 +1,199 @@
+#include "chunk.hpp"
+#include "compiler.hpp"
+#include "heap.hpp"
+#include "optimizer.hpp"
+#include "vm.hpp"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+TEST(OptimizerTests, givenChunkWithRedundantInstructionsWhenOptimizingThenPeepholeRewritesAreApplied)
+{
+    const char* source = R"(
+{
+    var a = 1;
+    var b = 2;
+    a = b;
+    print a;
+    print !(a == b);
+    3;
+}
+)";
+    Lux::Compiler compiler;
+    Lux::Chunk chunk;
+    Lux::Heap heap;
+    ASSERT_TRUE(compiler.compile(source, chunk, heap));
+
+    Lux::Optimizer::optimize(chunk, 1);
+
+    using Lux::OpCode;
+    std::vector<uint8_t> expected = {
+        (uint8_t)OpCode::Constant, 0,
+        (uint8_t)OpCode::Constant, 1,
+        (uint8_t)OpCode::GetLocal, 1,
+        (uint8_t)OpCode::SetLocal, 0,
+        (uint8_t)OpCode::Print,
+        (uint8_t)OpCode::GetLocal, 0,
+        (uint8_t)OpCode::GetLocal, 1,
+        (uint8_t)OpCode::NotEqual,
+        (uint8_t)OpCode::Print,
+        (uint8_t)OpCode::PopN, 2,
+        (uint8_t)OpCode::Return
+    };
+    std::vector<uint8_t> code(chunk.getCodeRawPtr(), chunk.getCodeRawPtr() + chunk.getCodeSize());
+    EXPECT_EQ(code, expected);
+    EXPECT_EQ(chunk.getConstantCount(), 2u);
+    EXPECT_EQ(chunk.getLine(chunk.getCodeSize() - 3), 9u);
+}
+
+TEST(OptimizerTests, givenFrequentInstructionSequencesWhenOptimizingAtLevel2ThenTheyAreFused)
+{
+    const char* source = R"(
+var g = 1;
+{
+    var a = g;
+    var b = 2;
+    print g;
+    print a + b;
+    print a + 3;
+    print !(a < b);
+    print a +
+        b;
+}
+)";
+    Lux::Compiler compiler;
+    Lux::Chunk chunk;
+    Lux::Heap heap;
+    ASSERT_TRUE(compiler.compile(source, chunk, heap));
+
+    Lux::Optimizer::optimize(chunk, 2);
+
+    using Lux::OpCode;
+    std::vector<uint8_t> expected = {
+        (uint8_t)OpCode::Constant, 0,
+        (uint8_t)OpCode::DefGlobalSlot, 0,
+        (uint8_t)OpCode::GetGlobalSlot, 0,
+        (uint8_t)OpCode::Constant, 1,
+        (uint8_t)OpCode::PrintGlobalSlot, 0,
+        (uint8_t)OpCode::AddLocals, 0, 1,
+        (uint8_t)OpCode::Print,
+        (uint8_t)OpCode::GetLocal, 0,
+        (uint8_t)OpCode::AddConstant, 2,
+        (uint8_t)OpCode::Print,
+        (uint8_t)OpCode::GetLocalPair, 0, 1,
+        (uint8_t)OpCode::NotLess,
+        (uint8_t)OpCode::Print,
+        (uint8_t)OpCode::GetLocal, 0,
+        (uint8_t)OpCode::GetLocal, 1,
+        (uint8_t)OpCode::Add,
+        (uint8_t)OpCode::Print,
+        (uint8_t)OpCode::PopN, 2,
+        (uint8_t)OpCode::Return
+    };
+    std::vector<uint8_t> code(chunk.getCodeRawPtr(), chunk.getCodeRawPtr() + chunk.getCodeSize());
+    EXPECT_EQ(code, expected);
+}
+
+TEST(OptimizerTests, givenOptimizationEnabledWhenInterpretingThenOutputIsTheSame)
+{
+    const char* source = R"(
+var g = 1;
+{
+    var a = 2;
+    var b = a;
+    g = a;
+    print g;
+    a = a + b;
+    print a;
+    print !(a != 4);
+    print !(a < b);
+    print a + 1;
+    nil;
+}
+print g + 1;
+print g;
+)";
+    for (int level = 0; level <= Lux::Optimizer::MAX_LEVEL; level++) {
+        Lux::VM vm;
+        vm.setOptimizationLevel(level);
+
+        testing::internal::CaptureStdout();
+        EXPECT_EQ(vm.interpret(source), Lux::InterpretResult::Success);
+        std::fflush(stdout);
+        EXPECT_EQ(testing::internal::GetCapturedStdout(), "2\n4\ntrue\ntrue\n5\n3\n2\n");
+    }
+}
+
+TEST(OptimizerTests, givenJumpsWhenOptimizingThenInstructionsTheyJumpToAreKeptAndShortJumpsAreUsedWhereTheyFit)
+{
+    std::string source = R"(
+var c = true;
+{
+    var a = 1;
+    if (c) a = 2;
+}
+if (c) {
+)";
+    for (int i = 0; i < 100; i++)
+        source += "    print c;\n";
+    source += "}\n";
+
+    Lux::Compiler compiler;
+    Lux::Chunk chunk;
+    Lux::Heap heap;
+    ASSERT_TRUE(compiler.compile(source.c_str(), chunk, heap));
+
+    Lux::Optimizer::optimize(chunk, 1);
+
+    // The else branch and the end of the scope both pop, but the jump over the else branch skips only the first one.
+    using Lux::OpCode;
+    std::vector<uint8_t> expected = {
+        (uint8_t)OpCode::True,
+        (uint8_t)OpCode::DefGlobalSlot, 0,
+        (uint8_t)OpCode::Constant, 0,
+        (uint8_t)OpCode::GetGlobalSlot, 0,
+        (uint8_t)OpCode::JumpIfFalse, 8,
+        (uint8_t)OpCode::Pop,
+        (uint8_t)OpCode::Constant, 1,
+        (uint8_t)OpCode::SetLocal, 0,
+        (uint8_t)OpCode::Pop,
+        (uint8_t)OpCode::Jump, 1,
+        (uint8_t)OpCode::Pop,
+        (uint8_t)OpCode::Pop,
+        (uint8_t)OpCode::GetGlobalSlot, 0,
+        (uint8_t)OpCode::JumpIfFalseLong
+    };
+    std::vector<uint8_t> code(chunk.getCodeRawPtr(), chunk.getCodeRawPtr() + expected.size());
+    EXPECT_EQ(code, expected);
+    EXPECT_EQ(chunk.getJumpTarget(expected.size() - 1), chunk.getCodeSize() - 2);
+}
+
+TEST(OptimizerTests, givenControlFlowWhenInterpretingAtEveryLevelThenOutputIsTheSame)
+{
+    const char* source = R"(
+var s = "";
+for (var i = 0; i < 5; i = i + 1) {
+    var d = i;
+    if (i == 1 or i == 3) s = s + "o";
+    else if (i > 1 and d < 3) s = s + "t";
+    else s = s + "e";
+}
+print s;
+{
+    var n = 0;
+    while (n < 3) n = n + 1;
+    print n and !n;
+}
+)";
+    for (int level = 0; level <= Lux::Optimizer::MAX_LEVEL; level++) {
+        Lux::VM vm;
+        vm.setOptimizationLevel(level);
+
+        testing::internal::CaptureStdout();
+        EXPECT_EQ(vm.interpret(source), Lux::InterpretResult::Success);
+        std::fflush(stdout);
+        EXPECT_EQ(testing::internal::GetCapturedStdout(), "eotoe\nfalse\n") << level;
+    }
+}
@@ -0,0 +1,172 @@
+#include "optimizer.hpp"
+#include "program.hpp"
+#include "vm.hpp"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+static std::vector<Lux::OpCode> decodeOpcodes(const uint8_t* code, size_t size)
+{
+    std::vector<Lux::OpCode> opcodes;
+    for (size_t offset = 0; offset < size; offset += Lux::getInstructionSize(opcodes.back()))
+        opcodes.emplace_back(static_cast<Lux::OpCode>(code[offset]));
+    return opcodes;
+}
+
+static size_t countOpcode(const std::vector<Lux::OpCode>& opcodes, Lux::OpCode opcode)
+{
+    return std::count(opcodes.begin(), opcodes.end(), opcode);
+}
+
+static std::string runAndCaptureOutput(Lux::VM& vm, const Lux::Program& program, Lux::Globals globals, Lux::InterpretResult expectedResult)
+{
+    testing::internal::CaptureStdout();
+    EXPECT_EQ(vm.run(program, globals), expectedResult);
+    std::fflush(stdout);
+    return testing::internal::GetCapturedStdout();
+}
+
+TEST(ProgramTests, givenCompiledProgramWhenRunningManyTimesInSeveralVMsThenEachRunStartsWithFreshGlobals)
+{
+    auto program = Lux::Program::compile(R"(
+var a = "a";
+var ab = a + "b";
+print ab == "ab";
+print ab + a;
+)");
+    ASSERT_NE(program, nullptr);
+
+    // Every allocation makes the VM collect garbage, the program's strings must survive it.
+    Lux::VM first{ Lux::VM::DEFAULT_STACK_CAPACITY, Lux::Heap::Config{ .nurserySize = 0 } };
+    Lux::VM second;
+    for (int i = 0; i < 3; i++) {
+        for (Lux::Backend backend : { Lux::Backend::Stack, Lux::Backend::Register }) {
+            for (Lux::VM* vm : { &first, &second }) {
+                vm->setBackend(backend);
+                EXPECT_EQ(runAndCaptureOutput(*vm, *program, Lux::Globals::Fresh, Lux::InterpretResult::Success), "true\naba\n");
+            }
+        }
+    }
+    EXPECT_GT(first.getHeap().getCollectionCount(), 0u);
+}
+
+TEST(ProgramTests, givenPersistentGlobalsWhenRunningSameProgramAgainThenGlobalsKeepTheirValues)
+{
+    auto counter = Lux::Program::compile(R"(var count = 0;
+count = count + 1;
+print count;
+)");
+    ASSERT_NE(counter, nullptr);
+    // Defining a global twice in one run fails, also when the previous run defined it.
+    auto redefine = Lux::Program::compile(R"(var x = 1;
+print x;
+var x = 2;
+)");
+    ASSERT_NE(redefine, nullptr);
+
+    Lux::VM vm;
+    for (Lux::Backend backend : { Lux::Backend::Stack, Lux::Backend::Register }) {
+        vm.setBackend(backend);
+        EXPECT_EQ(runAndCaptureOutput(vm, *counter, Lux::Globals::Fresh, Lux::InterpretResult::Success), "1\n");
+        EXPECT_EQ(runAndCaptureOutput(vm, *counter, Lux::Globals::Persistent, Lux::InterpretResult::Success), "2\n");
+        EXPECT_EQ(runAndCaptureOutput(vm, *counter, Lux::Globals::Persistent, Lux::InterpretResult::Success), "3\n");
+        EXPECT_EQ(runAndCaptureOutput(vm, *counter, Lux::Globals::Fresh, Lux::InterpretResult::Success), "1\n");
+
+        for (Lux::Globals globals : { Lux::Globals::Fresh, Lux::Globals::Persistent }) {
+            EXPECT_EQ(runAndCaptureOutput(vm, *redefine, globals, Lux::InterpretResult::RuntimeError),
+                "1\nGlobal variable with such name already exists.\n\n[line 3] in script\n");
+        }
+    }
+
+    // Globals of another program are never kept.
+    auto other = Lux::Program::compile("var count = 5; print count;");
+    ASSERT_NE(other, nullptr);
+    EXPECT_EQ(runAndCaptureOutput(vm, *other, Lux::Globals::Persistent, Lux::InterpretResult::Success), "5\n");
+}
+
+TEST(ProgramTests, givenProgramRunAgainInSameVMWhenItsInstructionsWereQuickenedThenOutputIsTheSame)
+{
+    auto program = Lux::Program::compile(R"(
+var a = 1;
+var s = "s";
+{
+    var b = 2;
+    var c = a + b;
+    print c + b;
+    print c + 0.5;
+    print c == 3;
+    print c != b;
+    print s + s == "ss";
+}
+)", Lux::Optimizer::MAX_LEVEL);
+    ASSERT_NE(program, nullptr);
+
+    using Lux::OpCode;
+    const Lux::Chunk& chunk = program->getChunk();
+    std::vector<OpCode> compiled = decodeOpcodes(chunk.getCodeRawPtr(), chunk.getCodeSize());
+    EXPECT_EQ(countOpcode(compiled, OpCode::Add), 2u);
+    EXPECT_EQ(countOpcode(compiled, OpCode::AddLocals), 1u);
+    EXPECT_EQ(countOpcode(compiled, OpCode::AddConstant), 1u);
+    EXPECT_EQ(countOpcode(compiled, OpCode::Equal), 2u);
+    EXPECT_EQ(countOpcode(compiled, OpCode::NotEqual), 1u);
+
+    // The first run rewrites the arithmetic and comparisons on numbers to their number forms, later runs
+    // execute those. The ones on strings stay generic and the program's own code is never written to.
+    Lux::VM vm;
+    for (int i = 0; i < 3; i++) {
+        EXPECT_EQ(runAndCaptureOutput(vm, *program, Lux::Globals::Fresh, Lux::InterpretResult::Success), "5\n3.5\ntrue\ntrue\ntrue\n");
+
+        const std::vector<uint8_t>& code = vm.getProgramCode();
+        std::vector<OpCode> quickened = decodeOpcodes(code.data(), code.size());
+        EXPECT_EQ(countOpcode(quickened, OpCode::AddNumber), 1u);
+        EXPECT_EQ(countOpcode(quickened, OpCode::Add), 1u);
+        EXPECT_EQ(countOpcode(quickened, OpCode::AddLocalsNumber), 1u);
+        EXPECT_EQ(countOpcode(quickened, OpCode::AddConstantNumber), 1u);
+        EXPECT_EQ(countOpcode(quickened, OpCode::EqualNumber), 1u);
+        EXPECT_EQ(countOpcode(quickened, OpCode::Equal), 1u);
+        EXPECT_EQ(countOpcode(quickened, OpCode::NotEqualNumber), 1u);
+        EXPECT_EQ(decodeOpcodes(chunk.getCodeRawPtr(), chunk.getCodeSize()), compiled);
+    }
+}
+
+TEST(ProgramTests, givenOperandTypesChangingInLoopWhenRunningThenQuickenedInstructionsRevertToGenericOnes)
+{
+    // Everything on v is quickened in the first iterations, v becomes a string in the last one.
+    auto program = Lux::Program::compile(R"(
+var v = 1;
+for (var i = 0; i < 3; i = i + 1) {
+    if (i == 2) v = "s";
+    var a = v;
+    var b = v;
+    print a + b;
+    print v + v;
+    print v == v;
+    print v != v;
+    print v + 1;
+}
+)", Lux::Optimizer::MAX_LEVEL);
+    ASSERT_NE(program, nullptr);
+
+    Lux::VM vm;
+    EXPECT_EQ(runAndCaptureOutput(vm, *program, Lux::Globals::Fresh, Lux::InterpretResult::RuntimeError),
+        "2\n2\ntrue\nfalse\n2\n2\n2\ntrue\nfalse\n2\nss\nss\ntrue\nfalse\n"
+        "Operands must be two numbers or two strings.\n\n[line 11] in script\n");
+
+    // Only the comparison and increment of i stay quickened.
+    using Lux::OpCode;
+    const std::vector<uint8_t>& code = vm.getProgramCode();
+    std::vector<OpCode> opcodes = decodeOpcodes(code.data(), code.size());
+    EXPECT_EQ(countOpcode(opcodes, OpCode::AddNumber), 0u);
+    EXPECT_EQ(countOpcode(opcodes, OpCode::Add), 1u);
+    EXPECT_EQ(countOpcode(opcodes, OpCode::AddLocalsNumber), 0u);
+    EXPECT_EQ(countOpcode(opcodes, OpCode::AddLocals), 1u);
+    EXPECT_EQ(countOpcode(opcodes, OpCode::AddConstantNumber), 1u);
+    EXPECT_EQ(countOpcode(opcodes, OpCode::AddConstant), 1u);
+    EXPECT_EQ(countOpcode(opcodes, OpCode::EqualNumber), 1u);
+    EXPECT_EQ(countOpcode(opcodes, OpCode::Equal), 1u);
+    EXPECT_EQ(countOpcode(opcodes, OpCode::NotEqualNumber), 0u);
+    EXPECT_EQ(countOpcode(opcodes, OpCode::NotEqual), 1u);
+}
@@ -0,0 +1,142 @@
+#include "chunk.hpp"
+#include "compiler.hpp"
+#include "heap.hpp"
+#include "register_chunk.hpp"
+#include "register_generator.hpp"
+#include "vm.hpp"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+TEST(RegisterGeneratorTests, givenAssignmentOfBinaryExpressionToLocalWhenGeneratingThenItIsComputedStraightIntoTheLocal)
+{
+    const char* source = R"(
+{
+    var a = 1;
+    var b = 2;
+    var c = 3;
+    a = b + c;
+}
+)";
+    Lux::Compiler compiler;
+    Lux::Chunk chunk;
+    Lux::Heap heap;
+    ASSERT_TRUE(compiler.compile(source, chunk, heap));
+
+    Lux::RegisterChunk registerChunk;
+    ASSERT_TRUE(Lux::RegisterGenerator::generate(chunk, registerChunk));
+
+    ASSERT_EQ(registerChunk.getCodeSize(), 4u);
+    const Lux::RegisterInstruction& add = registerChunk.getInstruction(2);
+    EXPECT_EQ(add.opcode, Lux::RegisterOpCode::Add);
+    EXPECT_EQ(add.a, 0u);
+    EXPECT_EQ(add.b, 1u);
+    EXPECT_EQ(add.c, 2u);
+    EXPECT_EQ(registerChunk.getInstruction(3).opcode, Lux::RegisterOpCode::Return);
+}
+
+TEST(RegisterGeneratorTests, givenRegisterBackendWhenInterpretingThenOutputIsTheSameAsOnStackBackend)
+{
+    const char* sources[] = {
+        R"(
+var g = 1;
+{
+    var a = 2;
+    var b = a;
+    a = a + b * 3;
+    print a;
+    print b;
+    g = g + a;
+    var s = "x";
+    s = s + s;
+    print s + "y" == "xxy";
+    print !(a < g);
+}
+print g;
+)",
+        R"(
+{
+    var a = 1;
+    print a;
+    print -"a";
+}
+)",
+        R"(
+print g;
+)",
+    };
+    for (const char* source : sources) {
+        std::string outputs[2];
+        for (Lux::Backend backend : { Lux::Backend::Stack, Lux::Backend::Register }) {
+            Lux::VM vm;
+            vm.setOptimizationLevel(2);
+            vm.setBackend(backend);
+
+            testing::internal::CaptureStdout();
+            vm.interpret(source);
+            std::fflush(stdout);
+            outputs[static_cast<int>(backend)] = testing::internal::GetCapturedStdout();
+        }
+        EXPECT_EQ(outputs[1], outputs[0]);
+    }
+}
+
+TEST(RegisterGeneratorTests, givenBranchesAndLoopsWhenRunningOnRegisterBackendThenTheyAreGeneratedAndBehaveAsOnStackBackend)
+{
+    const char* source = R"(
+var total = 0;
+for (var i = 0; i < 10; i = i + 1) {
+    if (i == 3 or i == 5) total = total + 100;
+    else if (i > 7 and i != 9) total = total - 1;
+    else total = total + i;
+}
+print total;
+var k = 0;
+while (k < 3) {
+    var s = "x";
+    k = k + 1;
+    print s + "y" == "xy" and k;
+}
+print nil or "fallback";
+print false and 1;
+{
+    var a = 1;
+    var b = a;
+    while (a < 100) {
+        a = a + b;
+        b = a;
+    }
+    print a;
+}
+)";
+    for (int level : { 0, 2 }) {
+        Lux::VM vm;
+        vm.setOptimizationLevel(level);
+        Lux::Chunk chunk;
+        ASSERT_TRUE(vm.compile(source, chunk));
+
+        Lux::RegisterChunk registerChunk;
+        ASSERT_TRUE(Lux::RegisterGenerator::generate(chunk, registerChunk));
+        size_t loops = 0;
+        for (size_t i = 0; i < registerChunk.getCodeSize(); i++)
+            loops += registerChunk.getInstruction(i).opcode == Lux::RegisterOpCode::Loop;
+        EXPECT_EQ(loops, 3u);
+
+        std::string outputs[2];
+        std::vector<uint64_t> backedgeCounts[2];
+        for (Lux::Backend backend : { Lux::Backend::Stack, Lux::Backend::Register }) {
+            vm.setBackend(backend);
+            testing::internal::CaptureStdout();
+            EXPECT_EQ(vm.interpret(chunk), Lux::InterpretResult::Success);
+            std::fflush(stdout);
+            outputs[static_cast<int>(backend)] = testing::internal::GetCapturedStdout();
+            backedgeCounts[static_cast<int>(backend)] = vm.getBackedgeCounts();
+        }
+        EXPECT_EQ(outputs[0], "228\n1\n2\n3\nfallback\nfalse\n128\n");
+        EXPECT_EQ(outputs[1], outputs[0]);
+        EXPECT_EQ(backedgeCounts[0], (std::vector<uint64_t>{ 10, 3, 7 }));
+        EXPECT_EQ(backedgeCounts[1], backedgeCounts[0]);
+    }
+}
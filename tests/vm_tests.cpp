@@ -0,0 +1,251 @@
+#include "vm.hpp"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+static std::string interpretAndCaptureOutput(Lux::VM& vm, const char* source, Lux::InterpretResult expectedResult)
+{
+    testing::internal::CaptureStdout();
+    Lux::InterpretResult result = vm.interpret(source);
+    std::fflush(stdout);
+    std::string output = testing::internal::GetCapturedStdout();
+    EXPECT_EQ(result, expectedResult);
+    return output;
+}
+
+TEST(VMTests, givenArithmeticAndLogicalExpressionsWhenInterpretingThenCorrectValuesArePrinted)
+{
+    const char* source = R"(
+var a = 2 * (3 + 8 / 2);
+{
+    var b = a - 1.5;
+    print b;
+}
+print !nil;
+print !(a == 14);
+print "con" + "cat";
+)";
+    Lux::VM vm;
+    std::string output = interpretAndCaptureOutput(vm, source, Lux::InterpretResult::Success);
+    EXPECT_STREQ(output.c_str(), "12.5\ntrue\nfalse\nconcat\n");
+}
+
+TEST(VMTests, givenScriptDeeperThanStackCapacityWhenInterpretingThenStackOverflowIsReported)
+{
+    const char* source = R"(
+var a = 1;
+print a + (a + (a + a));
+)";
+    Lux::VM vm{ 3 };
+    std::string output = interpretAndCaptureOutput(vm, source, Lux::InterpretResult::RuntimeError);
+    EXPECT_STREQ(output.c_str(), "Stack overflow.\n\n[line 3] in script\n");
+}
+
+TEST(VMTests, givenEqualStringsBuiltDifferentlyWhenComparingThenTheyAreEqual)
+{
+    const char* source = R"(
+var a = "ab";
+var b = "a" + "b";
+print a == b;
+print a != "a";
+print a + "c" == b + "c";
+print a + "c" == b + "d";
+print a + "c" == "abc";
+)";
+    Lux::VM vm;
+    std::string output = interpretAndCaptureOutput(vm, source, Lux::InterpretResult::Success);
+    EXPECT_STREQ(output.c_str(), "true\ntrue\ntrue\nfalse\ntrue\n");
+}
+
+TEST(VMTests, givenLongStringsBuiltByConcatenationWhenComparingAndPrintingAfterCollectionsThenContentsAreKept)
+{
+    // Concatenations this long are ropes, every allocation makes the VM collect garbage.
+    const char* source = R"(
+var a = "0123456789012345678901234567890123456789";
+var r = a + a;
+var s = r + "!";
+print s == a + a + "?";
+print s == "01234567890123456789012345678901234567890123456789012345678901234567890123456789!";
+print s == r + "!";
+print s != r;
+print s;
+)";
+    for (Lux::Backend backend : { Lux::Backend::Stack, Lux::Backend::Register }) {
+        Lux::VM vm{ Lux::VM::DEFAULT_STACK_CAPACITY, Lux::Heap::Config{ .nurserySize = 0 } };
+        vm.setBackend(backend);
+        std::string output = interpretAndCaptureOutput(vm, source, Lux::InterpretResult::Success);
+        EXPECT_EQ(output, "false\ntrue\ntrue\ntrue\n"
+            "01234567890123456789012345678901234567890123456789012345678901234567890123456789!\n");
+        EXPECT_GT(vm.getHeap().getCollectionCount(), 0u);
+    }
+}
+
+TEST(VMTests, givenGlobalUsedBeforeItsDefinitionWhenInterpretingThenUndefinedVariableIsReported)
+{
+    const char* source = R"(
+var counter = 1;
+counter = counter + 1;
+print counter;
+print later;
+var later = 2;
+)";
+    Lux::VM vm;
+    std::string output = interpretAndCaptureOutput(vm, source, Lux::InterpretResult::RuntimeError);
+    EXPECT_STREQ(output.c_str(), "2\nUndefined variable 'later'.\n\n[line 5] in script\n");
+}
+
+TEST(VMTests, givenMoreThan256ConstantsGlobalsAndLocalsWhenInterpretingThenWideOperandsAreUsed)
+{
+    std::string source;
+    for (int i = 0; i < 300; i++)
+        source += "var g" + std::to_string(i) + " = " + std::to_string(i) + ";\n";
+    source += "{\n";
+    for (int i = 0; i < 300; i++)
+        source += "var l" + std::to_string(i) + " = g" + std::to_string(i) + " + 1000;\n";
+    source += "l299 = l299 + l0;\nprint l299;\n}\n";
+    source += "g299 = g299 + 1;\nprint g299;\nprint \"g\" + \"299\";\n";
+
+    Lux::VM vm;
+    std::string output = interpretAndCaptureOutput(vm, source.c_str(), Lux::InterpretResult::Success);
+    EXPECT_STREQ(output.c_str(), "2299\n300\ng299\n");
+}
+
+TEST(VMTests, givenManyTemporaryStringsWhenInterpretingWithSmallHeapThenGarbageIsCollected)
+{
+    std::string source = "var s = \"\";\n";
+    for (int i = 0; i < 500; i++)
+        source += "s = s + \"x\"; print (s + \"-\" + \"" + std::to_string(i) + "\") == \"\";\n";
+    source += "var t = \"\";\n{\n var keep = s;\n s = \"\";\n t = keep + \"!\";\n}\n";
+
+    Lux::Heap::Config config;
+    config.nurserySize = 512;
+    config.initialThreshold = 4096;
+    Lux::VM vm{ Lux::VM::DEFAULT_STACK_CAPACITY, config };
+    std::string output = interpretAndCaptureOutput(vm, source.c_str(), Lux::InterpretResult::Success);
+
+    std::string expected;
+    for (int i = 0; i < 500; i++) expected += "false\n";
+    EXPECT_EQ(output, expected);
+    EXPECT_GT(vm.getHeap().getCollectionCount(), 0u);
+    // Intermediate strings add up to over 150 KB, only constants and the last few strings can be alive.
+    EXPECT_LT(vm.getHeap().getBytesAllocated(), 64u * 1024u);
+}
+
+TEST(VMTests, givenGlobalsAccessedByNameWhenRunningRepeatedlyThenCachedSlotsMatchSlotsOfCompiledGlobals)
+{
+    Lux::VM vm;
+    Lux::Chunk chunk;
+    Lux::String* counter = vm.getHeap().makeString("counter", 7);
+    Lux::String* later = vm.getHeap().makeString("later", 5);
+    using Lux::OpCode;
+
+    // counter is defined through its compiled slot and then updated by name, later is only known by name.
+    size_t slot = chunk.addGlobal(counter);
+    chunk.writeConstant(Lux::Value::makeNumber(1), 1, OpCode::Constant, OpCode::ConstantLong);
+    chunk.writeIndexed(slot, 1, OpCode::DefGlobalSlot, OpCode::DefGlobalSlotLong);
+    for (int i = 0; i < 3; i++) {
+        chunk.writeConstant(Lux::Value::makeObject(counter), 2, OpCode::GetGlobal, OpCode::GetGlobalLong);
+        chunk.writeConstant(Lux::Value::makeNumber(1), 2, OpCode::Constant, OpCode::ConstantLong);
+        chunk.write(static_cast<uint8_t>(OpCode::Add), 2);
+        chunk.writeConstant(Lux::Value::makeObject(counter), 2, OpCode::SetGlobal, OpCode::SetGlobalLong);
+        chunk.write(static_cast<uint8_t>(OpCode::Pop), 2);
+    }
+    chunk.writeIndexed(slot, 3, OpCode::GetGlobalSlot, OpCode::GetGlobalSlotLong);
+    chunk.write(static_cast<uint8_t>(OpCode::Print), 3);
+    chunk.writeConstant(Lux::Value::makeObject(later), 4, OpCode::GetGlobal, OpCode::GetGlobalLong);
+    chunk.write(static_cast<uint8_t>(OpCode::Print), 4);
+    chunk.write(static_cast<uint8_t>(OpCode::Return), 4);
+    ASSERT_TRUE(chunk.computeMaxStackDepth());
+
+    // Every run binds the globals again, so nothing cached by the previous run may be used.
+    for (int run = 0; run < 2; run++) {
+        testing::internal::CaptureStdout();
+        EXPECT_EQ(vm.interpret(chunk), Lux::InterpretResult::RuntimeError);
+        std::fflush(stdout);
+        EXPECT_EQ(testing::internal::GetCapturedStdout(), "4\nUndefined variable 'later'.\n\n[line 4] in script\n");
+    }
+}
+
+TEST(VMTests, givenGlobalAccessedByNameInLoopWhenRunningThenOnlyTheFirstLookupMissesTheCache)
+{
+    Lux::VM vm;
+    Lux::Chunk chunk;
+    Lux::String* counter = vm.getHeap().makeString("counter", 7);
+    using Lux::OpCode;
+
+    // counter = 0; while (counter < 10) counter = counter + 1; print counter;
+    // with every access in the loop going through the name.
+    size_t slot = chunk.addGlobal(counter);
+    chunk.writeConstant(Lux::Value::makeNumber(0), 1, OpCode::Constant, OpCode::ConstantLong);
+    chunk.writeIndexed(slot, 1, OpCode::DefGlobalSlot, OpCode::DefGlobalSlotLong);
+    size_t loop = chunk.addLoop();
+    size_t loopStart = chunk.getCodeSize();
+    chunk.writeConstant(Lux::Value::makeObject(counter), 2, OpCode::GetGlobal, OpCode::GetGlobalLong);
+    chunk.writeConstant(Lux::Value::makeNumber(10), 2, OpCode::Constant, OpCode::ConstantLong);
+    chunk.write(static_cast<uint8_t>(OpCode::Less), 2);
+    size_t exitJump = chunk.writeJump(OpCode::JumpIfFalseLong, 2);
+    chunk.write(static_cast<uint8_t>(OpCode::Pop), 2);
+    chunk.writeConstant(Lux::Value::makeObject(counter), 2, OpCode::GetGlobal, OpCode::GetGlobalLong);
+    chunk.writeConstant(Lux::Value::makeNumber(1), 2, OpCode::Constant, OpCode::ConstantLong);
+    chunk.write(static_cast<uint8_t>(OpCode::Add), 2);
+    chunk.writeConstant(Lux::Value::makeObject(counter), 2, OpCode::SetGlobal, OpCode::SetGlobalLong);
+    chunk.write(static_cast<uint8_t>(OpCode::Pop), 2);
+    ASSERT_TRUE(chunk.writeLoop(loopStart, loop, 2));
+    ASSERT_TRUE(chunk.patchJump(exitJump));
+    chunk.write(static_cast<uint8_t>(OpCode::Pop), 2);
+    chunk.writeIndexed(slot, 3, OpCode::GetGlobalSlot, OpCode::GetGlobalSlotLong);
+    chunk.write(static_cast<uint8_t>(OpCode::Print), 3);
+    chunk.write(static_cast<uint8_t>(OpCode::Return), 3);
+    ASSERT_TRUE(chunk.computeMaxStackDepth());
+
+    for (int run = 0; run < 2; run++) {
+        testing::internal::CaptureStdout();
+        EXPECT_EQ(vm.interpret(chunk), Lux::InterpretResult::Success);
+        std::fflush(stdout);
+        EXPECT_EQ(testing::internal::GetCapturedStdout(), "10\n");
+        // All 31 lookups use the same name constant, only the first of each run searches the table.
+        EXPECT_EQ(vm.getGlobalCacheMisses(), 1u);
+        EXPECT_EQ(vm.getBackedgeCounts(), std::vector<uint64_t>{ 10 });
+    }
+}
+
+TEST(VMTests, givenLoopsWhenInterpretingThenEachLoopCountsItsBackedges)
+{
+    std::string source = R"(
+var total = 0;
+for (var i = 0; i < 10; i = i + 1) {
+    var j = 0;
+    while (j < i) j = j + 1;
+    total = total + j;
+}
+print total;
+var k = 0;
+while (k < 3) {
+)";
+    // A body this long only fits a LoopLong.
+    for (int i = 0; i < 100; i++)
+        source += "    total = total;\n";
+    source += "    k = k + 1;\n}\nprint k;\n";
+
+    Lux::VM vm;
+    std::string output = interpretAndCaptureOutput(vm, source.c_str(), Lux::InterpretResult::Success);
+    EXPECT_STREQ(output.c_str(), "45\n3\n");
+    EXPECT_EQ(vm.getBackedgeCounts(), (std::vector<uint64_t>{ 10, 45, 3 }));
+}
+
+TEST(VMTests, givenOperandTypesChangingInLoopWhenInterpretingThenQuickenedInstructionsAreDeoptimized)
+{
+    const char* source = R"(
+var v = 1;
+for (var i = 0; i < 4; i = i + 1) {
+    if (i == 2) v = "s";
+    print v + v;
+    print v == v;
+}
+)";
+    Lux::VM vm;
+    std::string output = interpretAndCaptureOutput(vm, source, Lux::InterpretResult::Success);
+    EXPECT_STREQ(output.c_str(), "2\ntrue\n2\ntrue\nss\ntrue\nss\ntrue\n");
+}